@@ -19,12 +19,9 @@ glm::quat Asteroid::GetAngM(void) const {
 void Asteroid::SetAngM(glm::quat angm){
 
     angm_ = angm;
-}
-
-
-void Asteroid::Update(void){
-
-    Rotate(angm_);
+    // The scene graph applies the rotation every update, together with
+    // all the other spinning nodes
+    SetSpin(angm);
 }
             
 } // namespace game
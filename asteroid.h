@@ -27,9 +27,6 @@ namespace game {
             // Get/set attributes specific to asteroids
             glm::quat GetAngM(void) const;
             void SetAngM(glm::quat angm);
-
-            // Update geometry configuration
-            void Update(void);
             
         private:
             // Angular momentum of asteroid
@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <iomanip>
+#include <cstdio>
+
+#include "benchmark.h"
+
+namespace game {
+
+Benchmark::Benchmark(void){
+}
+
+
+void Benchmark::AddFrame(double seconds, const DrawStats &stats){
+
+    frame_time_.push_back(seconds * 1000.0);
+    draws_.push_back(stats.draws);
+    triangles_.push_back(stats.triangles);
+}
+
+
+void Benchmark::WriteReport(std::ostream &out, std::string path) const {
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\n";
+    out << "  \"path\": ";
+    WriteString(out, path);
+    out << ",\n";
+    out << "  \"frames\": " << frame_time_.size() << ",\n";
+    out << "  \"frame_ms\": ";
+    WriteSeries(out, frame_time_);
+    out << ",\n  \"draws\": ";
+    WriteSeries(out, draws_);
+    out << ",\n  \"triangles\": ";
+    WriteSeries(out, triangles_);
+    out << "\n}\n";
+    out << std::defaultfloat << std::setprecision(6);
+}
+
+
+void Benchmark::WriteString(std::ostream &out, const std::string &value){
+
+    out << '"';
+    for (int i = 0; i < value.size(); i++){
+        unsigned char c = value[i];
+        if (c == '"' || c == '\\'){
+            out << '\\' << c;
+        } else if (c < 0x20){
+            // Control characters as \u escapes
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out << escape;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+
+void Benchmark::WriteSeries(std::ostream &out, std::vector<double> value){
+
+    int n = value.size();
+    if (n == 0){
+        out << "null";
+        return;
+    }
+    std::sort(value.begin(), value.end());
+    double sum = 0.0;
+    for (int i = 0; i < n; i++){
+        sum += value[i];
+    }
+
+    // Nearest rank
+    out << "{\"mean\": " << sum / n;
+    out << ", \"p50\": " << value[std::max(0, (n * 50 + 99) / 100 - 1)];
+    out << ", \"p95\": " << value[std::max(0, (n * 95 + 99) / 100 - 1)];
+    out << ", \"p99\": " << value[std::max(0, (n * 99 + 99) / 100 - 1)];
+    out << ", \"max\": " << value[n - 1] << "}";
+}
+
+} // namespace game
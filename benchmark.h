@@ -0,0 +1,41 @@
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "draw_queue.h"
+
+namespace game {
+
+    // Measurements of a benchmark run, one sample per frame
+    class Benchmark {
+
+        public:
+            Benchmark(void);
+
+            // Add a frame that took 'seconds' and drew with 'stats'
+            void AddFrame(double seconds, const DrawStats &stats);
+
+            // Write the number of frames, and the mean, median, 95th and
+            // 99th percentile and maximum of the frame time in
+            // milliseconds, of the draw calls and of the triangles per
+            // frame, as JSON; 'path' names the path that was run
+            void WriteReport(std::ostream &out, std::string path) const;
+
+        private:
+            std::vector<double> frame_time_;
+            std::vector<double> draws_;
+            std::vector<double> triangles_;
+
+            // Write a string as a JSON string literal, escaped
+            static void WriteString(std::ostream &out, const std::string &value);
+            // Write the statistics of one measurement as a JSON object
+            static void WriteSeries(std::ostream &out, std::vector<double> value);
+
+    }; // class Benchmark
+
+} // namespace game
+
+#endif // BENCHMARK_H_
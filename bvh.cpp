@@ -0,0 +1,489 @@
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+
+#include "bvh.h"
+
+namespace game {
+
+// Extra room around the sphere of a leaf, in world units
+#define BVH_FAT_MARGIN 1.0f
+// Smallest direction component of a ray, so its inverse stays finite
+#define BVH_MIN_DIRECTION 1e-8f
+
+
+// Half of the surface area of a box; enough to compare costs
+static float BoxArea(glm::vec3 min, glm::vec3 max){
+
+    glm::vec3 d = max - min;
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+
+static bool BoxContains(glm::vec3 min, glm::vec3 max, glm::vec3 inner_min, glm::vec3 inner_max){
+
+    return min.x <= inner_min.x && min.y <= inner_min.y && min.z <= inner_min.z &&
+           inner_max.x <= max.x && inner_max.y <= max.y && inner_max.z <= max.z;
+}
+
+
+static bool BoxOverlaps(glm::vec3 min1, glm::vec3 max1, glm::vec3 min2, glm::vec3 max2){
+
+    return min1.x <= max2.x && min2.x <= max1.x &&
+           min1.y <= max2.y && min2.y <= max1.y &&
+           min1.z <= max2.z && min2.z <= max1.z;
+}
+
+
+Bvh::Bvh(void){
+
+    root_ = -1;
+    free_ = -1;
+    leaf_count_ = 0;
+}
+
+
+Bvh::~Bvh(){
+}
+
+
+int Bvh::AllocateNode(void){
+
+    int index;
+    if (free_ != -1){
+        index = free_;
+        free_ = node_[index].parent;
+    } else {
+        node_.push_back(Node());
+        index = node_.size() - 1;
+    }
+
+    Node &n = node_[index];
+    n.node = NULL;
+    n.parent = -1;
+    n.left = -1;
+    n.right = -1;
+    n.height = 0;
+    n.radius = 0.0;
+    return index;
+}
+
+
+void Bvh::FreeNode(int index){
+
+    node_[index].parent = free_;
+    node_[index].height = -1;
+    node_[index].node = NULL;
+    free_ = index;
+}
+
+
+bool Bvh::IsLeaf(int index) const {
+
+    return node_[index].left == -1;
+}
+
+
+void Bvh::SetLeafBounds(int index, glm::vec3 center, float radius, float margin){
+
+    Node &n = node_[index];
+    n.center = center;
+    n.radius = radius;
+    glm::vec3 extent(radius + margin);
+    n.min = center - extent;
+    n.max = center + extent;
+}
+
+
+int Bvh::Insert(SceneNode *node, glm::vec3 center, float radius, bool is_static){
+
+    int leaf = AllocateNode();
+    node_[leaf].node = node;
+    SetLeafBounds(leaf, center, radius, is_static ? 0.0f : BVH_FAT_MARGIN);
+    InsertLeaf(leaf);
+    leaf_count_++;
+    return leaf;
+}
+
+
+void Bvh::Remove(int proxy){
+
+    RemoveLeaf(proxy);
+    FreeNode(proxy);
+    leaf_count_--;
+}
+
+
+bool Bvh::Move(int proxy, glm::vec3 center, float radius){
+
+    Node &n = node_[proxy];
+    glm::vec3 tight_min = center - glm::vec3(radius);
+    glm::vec3 tight_max = center + glm::vec3(radius);
+
+    // Still inside the fat box: only the exact sphere changes
+    if (BoxContains(n.min, n.max, tight_min, tight_max)){
+        n.center = center;
+        n.radius = radius;
+        return false;
+    }
+
+    glm::vec3 old_min = n.min;
+    glm::vec3 old_max = n.max;
+    SetLeafBounds(proxy, center, radius, BVH_FAT_MARGIN);
+
+    if (BoxOverlaps(old_min, old_max, n.min, n.max)){
+        // Short move: grow or shrink the boxes above the leaf in place
+        Refit(n.parent);
+    } else {
+        // Long move: find a better place in the tree
+        RemoveLeaf(proxy);
+        InsertLeaf(proxy);
+    }
+    return true;
+}
+
+
+void Bvh::InsertLeaf(int leaf){
+
+    if (root_ == -1){
+        root_ = leaf;
+        node_[leaf].parent = -1;
+        return;
+    }
+
+    glm::vec3 leaf_min = node_[leaf].min;
+    glm::vec3 leaf_max = node_[leaf].max;
+
+    // Walk down to the sibling that increases the total area the least
+    int index = root_;
+    while (!IsLeaf(index)){
+        const Node &n = node_[index];
+        float area = BoxArea(n.min, n.max);
+        float combined = BoxArea(glm::min(n.min, leaf_min), glm::max(n.max, leaf_max));
+
+        // Cost of making a new parent for this node and the leaf
+        float cost = 2.0f * combined;
+        // Cost pushed down to the children by growing this node
+        float inheritance = 2.0f * (combined - area);
+
+        float child_cost[2];
+        int child[2] = { n.left, n.right };
+        for (int i = 0; i < 2; i++){
+            const Node &c = node_[child[i]];
+            float grown = BoxArea(glm::min(c.min, leaf_min), glm::max(c.max, leaf_max));
+            if (IsLeaf(child[i])){
+                child_cost[i] = grown + inheritance;
+            } else {
+                child_cost[i] = grown - BoxArea(c.min, c.max) + inheritance;
+            }
+        }
+
+        if (cost < child_cost[0] && cost < child_cost[1]){
+            break;
+        }
+        index = (child_cost[0] < child_cost[1]) ? child[0] : child[1];
+    }
+
+    // Join the leaf and its sibling under a new parent
+    int sibling = index;
+    int old_parent = node_[sibling].parent;
+    int new_parent = AllocateNode();
+    node_[new_parent].parent = old_parent;
+    node_[new_parent].left = sibling;
+    node_[new_parent].right = leaf;
+    node_[sibling].parent = new_parent;
+    node_[leaf].parent = new_parent;
+
+    if (old_parent == -1){
+        root_ = new_parent;
+    } else if (node_[old_parent].left == sibling){
+        node_[old_parent].left = new_parent;
+    } else {
+        node_[old_parent].right = new_parent;
+    }
+
+    Refit(new_parent);
+}
+
+
+void Bvh::RemoveLeaf(int leaf){
+
+    if (leaf == root_){
+        root_ = -1;
+        return;
+    }
+
+    // The sibling takes the place of the parent
+    int parent = node_[leaf].parent;
+    int grand_parent = node_[parent].parent;
+    int sibling = (node_[parent].left == leaf) ? node_[parent].right : node_[parent].left;
+
+    if (grand_parent == -1){
+        root_ = sibling;
+        node_[sibling].parent = -1;
+    } else {
+        if (node_[grand_parent].left == parent){
+            node_[grand_parent].left = sibling;
+        } else {
+            node_[grand_parent].right = sibling;
+        }
+        node_[sibling].parent = grand_parent;
+        Refit(grand_parent);
+    }
+    FreeNode(parent);
+    node_[leaf].parent = -1;
+}
+
+
+void Bvh::Refit(int index){
+
+    while (index != -1){
+        index = Balance(index);
+        Node &n = node_[index];
+        const Node &l = node_[n.left];
+        const Node &r = node_[n.right];
+        n.min = glm::min(l.min, r.min);
+        n.max = glm::max(l.max, r.max);
+        n.height = 1 + std::max(l.height, r.height);
+        index = n.parent;
+    }
+}
+
+
+int Bvh::Balance(int index){
+
+    Node &a = node_[index];
+    if (IsLeaf(index) || a.height < 2){
+        return index;
+    }
+
+    int b = a.left;
+    int c = a.right;
+    int balance = node_[c].height - node_[b].height;
+    if (balance >= -1 && balance <= 1){
+        return index;
+    }
+
+    // The taller child takes the place of the node, which keeps the other
+    // child and takes the shorter grandchild; the taller grandchild stays
+    // under the promoted child
+    int up = (balance > 1) ? c : b;
+    int other = (balance > 1) ? b : c;
+    Node &u = node_[up];
+    int tall = u.left;
+    int short_child = u.right;
+    if (node_[tall].height < node_[short_child].height){
+        std::swap(tall, short_child);
+    }
+
+    u.parent = a.parent;
+    if (u.parent == -1){
+        root_ = up;
+    } else if (node_[u.parent].left == index){
+        node_[u.parent].left = up;
+    } else {
+        node_[u.parent].right = up;
+    }
+    a.parent = up;
+    u.left = index;
+    u.right = tall;
+
+    a.left = other;
+    a.right = short_child;
+    node_[short_child].parent = index;
+
+    const Node &o = node_[other];
+    const Node &s = node_[short_child];
+    a.min = glm::min(o.min, s.min);
+    a.max = glm::max(o.max, s.max);
+    a.height = 1 + std::max(o.height, s.height);
+    const Node &t = node_[tall];
+    u.min = glm::min(a.min, t.min);
+    u.max = glm::max(a.max, t.max);
+    u.height = 1 + std::max(a.height, t.height);
+    return up;
+}
+
+
+void Bvh::CollectLeaves(int index, std::vector<SceneNode *> &result){
+
+    int base = stack_.size();
+    stack_.push_back(index);
+    while (stack_.size() > base){
+        int i = stack_.back();
+        stack_.pop_back();
+        if (IsLeaf(i)){
+            result.push_back(node_[i].node);
+        } else {
+            stack_.push_back(node_[i].left);
+            stack_.push_back(node_[i].right);
+        }
+    }
+}
+
+
+void Bvh::QueryFrustum(const Frustum &frustum, std::vector<SceneNode *> &result){
+
+    result.clear();
+    candidate_.clear();
+    candidate_x_.clear();
+    candidate_y_.clear();
+    candidate_z_.clear();
+    candidate_radius_.clear();
+    if (root_ == -1){
+        return;
+    }
+
+    // Subtrees fully inside are taken whole; leaves whose boxes cross a
+    // plane are tested exactly afterwards, all in one batch
+    stack_.clear();
+    stack_.push_back(root_);
+    while (stack_.size() > 0){
+        int index = stack_.back();
+        stack_.pop_back();
+        const Node &n = node_[index];
+
+        Frustum::FrustumResult test = frustum.TestBox(n.min, n.max);
+        if (test == Frustum::Outside){
+            continue;
+        }
+        if (test == Frustum::Inside){
+            CollectLeaves(index, result);
+        } else if (IsLeaf(index)){
+            candidate_.push_back(index);
+            candidate_x_.push_back(n.center.x);
+            candidate_y_.push_back(n.center.y);
+            candidate_z_.push_back(n.center.z);
+            candidate_radius_.push_back(n.radius);
+        } else {
+            stack_.push_back(n.left);
+            stack_.push_back(n.right);
+        }
+    }
+
+    int count = candidate_.size();
+    if (count > 0){
+        candidate_visible_.resize(count);
+        frustum.TestSpheres(&candidate_x_[0], &candidate_y_[0], &candidate_z_[0], &candidate_radius_[0], count, &candidate_visible_[0]);
+        for (int i = 0; i < count; i++){
+            if (candidate_visible_[i]){
+                result.push_back(node_[candidate_[i]].node);
+            }
+        }
+    }
+}
+
+
+void Bvh::QuerySphere(glm::vec3 center, float radius, std::vector<SceneNode *> &result){
+
+    result.clear();
+    if (root_ == -1){
+        return;
+    }
+
+    stack_.clear();
+    stack_.push_back(root_);
+    while (stack_.size() > 0){
+        int index = stack_.back();
+        stack_.pop_back();
+        const Node &n = node_[index];
+
+        // Distance from the center to the closest point of the box
+        glm::vec3 d = center - glm::clamp(center, n.min, n.max);
+        if (glm::dot(d, d) > radius * radius){
+            continue;
+        }
+
+        if (IsLeaf(index)){
+            float reach = radius + n.radius;
+            glm::vec3 to_leaf = n.center - center;
+            if (glm::dot(to_leaf, to_leaf) <= reach * reach){
+                result.push_back(n.node);
+            }
+        } else {
+            stack_.push_back(n.left);
+            stack_.push_back(n.right);
+        }
+    }
+}
+
+
+void Bvh::QueryRay(glm::vec3 origin, glm::vec3 direction, float max_distance, std::vector<SceneNode *> &result, std::vector<float> &distance){
+
+    result.clear();
+    distance.clear();
+    if (root_ == -1){
+        return;
+    }
+
+    direction = glm::normalize(direction);
+    // Components along an axis are kept off zero, with their sign, so the
+    // slab test never computes 0 * inf when the origin is on a face
+    glm::vec3 inv_direction;
+    for (int i = 0; i < 3; i++){
+        float d = direction[i];
+        if (fabsf(d) < BVH_MIN_DIRECTION){
+            d = (d < 0.0f) ? -BVH_MIN_DIRECTION : BVH_MIN_DIRECTION;
+        }
+        inv_direction[i] = 1.0f / d;
+    }
+
+    stack_.clear();
+    stack_.push_back(root_);
+    while (stack_.size() > 0){
+        int index = stack_.back();
+        stack_.pop_back();
+        const Node &n = node_[index];
+
+        // Slab test of the segment against the box
+        glm::vec3 t1 = (n.min - origin) * inv_direction;
+        glm::vec3 t2 = (n.max - origin) * inv_direction;
+        glm::vec3 t_near = glm::min(t1, t2);
+        glm::vec3 t_far = glm::max(t1, t2);
+        float enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, 0.0f));
+        float exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, max_distance));
+        if (enter > exit){
+            continue;
+        }
+
+        if (IsLeaf(index)){
+            // Closest approach of the ray to the center of the sphere
+            glm::vec3 to_center = n.center - origin;
+            float along = glm::dot(to_center, direction);
+            float dist2 = glm::dot(to_center, to_center) - along * along;
+            float r2 = n.radius * n.radius;
+            if (dist2 > r2){
+                continue;
+            }
+            float hit = along - sqrtf(r2 - dist2);
+            if (hit < 0.0f){
+                // Origin inside the sphere
+                hit = 0.0f;
+            }
+            if (hit <= max_distance && along + sqrtf(r2 - dist2) >= 0.0f){
+                result.push_back(n.node);
+                distance.push_back(hit);
+            }
+        } else {
+            stack_.push_back(n.left);
+            stack_.push_back(n.right);
+        }
+    }
+}
+
+
+int Bvh::GetHeight(void) const {
+
+    if (root_ == -1){
+        return 0;
+    }
+    return node_[root_].height + 1;
+}
+
+
+int Bvh::GetLeafCount(void) const {
+
+    return leaf_count_;
+}
+
+} // namespace game
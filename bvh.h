@@ -0,0 +1,96 @@
+#ifndef BVH_H_
+#define BVH_H_
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "frustum.h"
+
+namespace game {
+
+    class SceneNode;
+
+    // Dynamic bounding volume hierarchy over the bounding spheres of scene
+    // nodes
+    // Leaves keep a box slightly larger than their sphere, so small moves
+    // do not touch the tree. A leaf that leaves its box is refitted in
+    // place when the move is short and reinserted otherwise. Insertion
+    // follows the surface area heuristic, and on the way back up from an
+    // insertion or removal a node whose subtrees differ in height by more
+    // than one is rotated, as in Box2D, so the tree stays balanced
+    class Bvh {
+
+        public:
+            Bvh(void);
+            ~Bvh();
+
+            // Add a node with its world bounding sphere; returns the id of
+            // its leaf. Static nodes never move, so their leaf gets the
+            // exact box of the sphere
+            int Insert(SceneNode *node, glm::vec3 center, float radius, bool is_static = false);
+            void Remove(int proxy);
+            // Update the bounds of a leaf after its node moved; returns
+            // true if the tree had to change
+            bool Move(int proxy, glm::vec3 center, float radius);
+
+            // Collect the nodes whose sphere touches the frustum
+            void QueryFrustum(const Frustum &frustum, std::vector<SceneNode *> &result);
+            // Collect the nodes whose sphere touches the given sphere
+            void QuerySphere(glm::vec3 center, float radius, std::vector<SceneNode *> &result);
+            // Collect the nodes whose sphere is hit by the ray within
+            // 'max_distance', with the distance of each hit along the ray
+            void QueryRay(glm::vec3 origin, glm::vec3 direction, float max_distance, std::vector<SceneNode *> &result, std::vector<float> &distance);
+
+            // Number of levels, zero for an empty tree
+            int GetHeight(void) const;
+            int GetLeafCount(void) const;
+
+        private:
+            struct Node {
+                glm::vec3 min; // Box of the subtree; fattened for leaves
+                glm::vec3 max;
+                glm::vec3 center; // Exact sphere, for leaves
+                float radius;
+                SceneNode *node; // NULL for internal nodes
+                int parent; // Next free node when unused
+                int left;
+                int right;
+                int height; // Zero for leaves, -1 for unused
+            };
+
+            std::vector<Node> node_;
+            int root_;
+            int free_;
+            int leaf_count_;
+
+            // Scratch storage for queries
+            std::vector<int> stack_;
+            std::vector<int> candidate_;
+            std::vector<float> candidate_x_;
+            std::vector<float> candidate_y_;
+            std::vector<float> candidate_z_;
+            std::vector<float> candidate_radius_;
+            std::vector<unsigned char> candidate_visible_;
+
+            int AllocateNode(void);
+            void FreeNode(int index);
+            bool IsLeaf(int index) const;
+            // Set the sphere of a leaf and its box, 'margin' larger
+            void SetLeafBounds(int index, glm::vec3 center, float radius, float margin);
+            void InsertLeaf(int leaf);
+            void RemoveLeaf(int leaf);
+            // Recompute boxes and heights from 'index' up to the root,
+            // balancing each node on the way
+            void Refit(int index);
+            // Rotate the taller child of a node above it when the heights
+            // of its children differ by more than one; returns the node
+            // now in its place
+            int Balance(int index);
+            // Add every leaf below 'index' to 'result'
+            void CollectLeaves(int index, std::vector<SceneNode *> &result);
+
+    }; // class Bvh
+
+} // namespace game
+
+#endif // BVH_H_
@@ -127,21 +127,22 @@ void Camera::SetProjection(GLfloat fov, GLfloat near, GLfloat far, GLfloat w, GL
 }
 
 
-void Camera::SetupShader(GLuint program){
+glm::mat4 Camera::GetViewMatrix(void){
 
-    // Update view matrix
     SetupViewMatrix();
+    return view_matrix_;
+}
+
+
+glm::mat4 Camera::GetProjectionMatrix(void) const {
+
+    return projection_matrix_;
+}
+
 
-    // Set view matrix in shader
-    GLint view_mat = glGetUniformLocation(program, "view_mat");
-    glUniformMatrix4fv(view_mat, 1, GL_FALSE, glm::value_ptr(view_matrix_));
-    
-    // Set projection matrix in shader
-    GLint projection_mat = glGetUniformLocation(program, "projection_mat");
-    glUniformMatrix4fv(projection_mat, 1, GL_FALSE, glm::value_ptr(projection_matrix_));
+Frustum Camera::GetFrustum(void){
 
-    GLint cam = glGetUniformLocation(program, "view_position");
-    glUniform3fv(cam, 1, glm::value_ptr(position_));
+    return Frustum(projection_matrix_ * GetViewMatrix());
 }
 
 
@@ -6,6 +6,7 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
+#include "frustum.h"
 
 namespace game {
 
@@ -45,8 +46,12 @@ namespace game {
             // Set projection from frustum parameters: field-of-view,
             // near and far planes, and width and height of viewport
             void SetProjection(GLfloat fov, GLfloat near, GLfloat far, GLfloat w, GLfloat h);
-            // Set all camera-related variables in shader program
-            void SetupShader(GLuint program);
+
+            // Current view and projection matrices
+            glm::mat4 GetViewMatrix(void);
+            glm::mat4 GetProjectionMatrix(void) const;
+            // View frustum in world space
+            Frustum GetFrustum(void);
 
         private:
             glm::vec3 position_; // Position of camera
@@ -0,0 +1,188 @@
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+#include "camera_path.h"
+
+namespace game {
+
+CameraPath::CameraPath(void){
+}
+
+
+void CameraPath::Load(std::string filename){
+
+    std::ifstream f;
+    f.open(filename.c_str());
+    if (f.fail()){
+        throw(std::ios_base::failure(std::string("Error opening file ")+filename));
+    }
+
+    pose_.clear();
+    event_.clear();
+    std::string line;
+    int line_number = 0;
+    while (std::getline(f, line)){
+        line_number++;
+        std::istringstream in(line);
+        int frame;
+        std::string command;
+        if (line.size() == 0 || line[0] == '#' || !(in >> frame)){
+            continue;
+        }
+        in >> command;
+
+        bool ok = true;
+        if (command == "pose"){
+            glm::vec2 position;
+            float yaw;
+            ok = bool(in >> position.x >> position.y >> yaw);
+            if (ok){
+                AddPose(frame, position, yaw);
+            }
+        } else if (command == "key" || command == "zone" || command == "block"){
+            PathEvent event;
+            event.frame = frame;
+            event.key = 0;
+            ok = bool(in >> event.name);
+            if (command == "key"){
+                event.type = KeyPathEvent;
+                // Letters and digits are their own GLFW code
+                if (ok && event.name.size() == 1 && isalnum(event.name[0])){
+                    event.key = toupper(event.name[0]);
+                } else if (ok){
+                    event.key = atoi(event.name.c_str());
+                }
+                ok = ok && event.key > 0;
+            } else {
+                event.type = (command == "zone") ? ZonePathEvent : BlockPathEvent;
+            }
+            if (ok){
+                AddEvent(event);
+            }
+        } else {
+            ok = false;
+        }
+        if (!ok){
+            std::ostringstream message;
+            message << "Bad line " << line_number << " in path " << filename << ": " << line;
+            throw(std::invalid_argument(message.str()));
+        }
+    }
+    f.close();
+
+    // Files written by hand need not be in order
+    std::stable_sort(pose_.begin(), pose_.end(), [](const Pose &a, const Pose &b){
+        return a.frame < b.frame;
+    });
+    std::stable_sort(event_.begin(), event_.end(), [](const PathEvent &a, const PathEvent &b){
+        return a.frame < b.frame;
+    });
+}
+
+
+void CameraPath::Save(std::string filename) const {
+
+    std::ofstream f;
+    f.open(filename.c_str());
+    if (f.fail()){
+        throw(std::ios_base::failure(std::string("Error opening file ")+filename));
+    }
+
+    // Poses and events merged by frame
+    f << "# frame pose x z yaw | key k | zone name | block name\n";
+    f << std::setprecision(9);
+    int p = 0;
+    int e = 0;
+    while (p < pose_.size() || e < event_.size()){
+        if (e >= event_.size() || (p < pose_.size() && pose_[p].frame <= event_[e].frame)){
+            const Pose &pose = pose_[p++];
+            f << pose.frame << " pose " << pose.position.x << " " << pose.position.y << " " << pose.yaw << "\n";
+        } else {
+            const PathEvent &event = event_[e++];
+            if (event.type == KeyPathEvent){
+                f << event.frame << " key ";
+                if (isalnum(event.key)){
+                    f << (char) event.key << "\n";
+                } else {
+                    f << event.key << "\n";
+                }
+            } else {
+                f << event.frame << (event.type == ZonePathEvent ? " zone " : " block ") << event.name << "\n";
+            }
+        }
+    }
+    f.close();
+}
+
+
+void CameraPath::AddPose(int frame, glm::vec2 position, float yaw){
+
+    Pose pose;
+    pose.frame = frame;
+    pose.position = position;
+    pose.yaw = yaw;
+    pose_.push_back(pose);
+}
+
+
+void CameraPath::AddEvent(const PathEvent &event){
+
+    event_.push_back(event);
+}
+
+
+bool CameraPath::GetPose(int frame, glm::vec2 &position, float &yaw) const {
+
+    if (pose_.size() == 0 || frame < pose_[0].frame){
+        return false;
+    }
+
+    // First keyframe after the frame
+    int next = std::upper_bound(pose_.begin(), pose_.end(), frame, [](int frame, const Pose &pose){
+        return frame < pose.frame;
+    }) - pose_.begin();
+    const Pose &a = pose_[next - 1];
+    if (next == pose_.size()){
+        position = a.position;
+        yaw = a.yaw;
+        return true;
+    }
+
+    const Pose &b = pose_[next];
+    float t = (float) (frame - a.frame) / (float) (b.frame - a.frame);
+    position = glm::mix(a.position, b.position, t);
+    yaw = glm::mix(a.yaw, b.yaw, t);
+    return true;
+}
+
+
+void CameraPath::GetEvents(int frame, std::vector<PathEvent> &events) const {
+
+    events.clear();
+    std::vector<PathEvent>::const_iterator it = std::lower_bound(event_.begin(), event_.end(), frame, [](const PathEvent &event, int frame){
+        return event.frame < frame;
+    });
+    for (; it != event_.end() && it->frame == frame; it++){
+        events.push_back(*it);
+    }
+}
+
+
+int CameraPath::GetLength(void) const {
+
+    int length = 0;
+    if (pose_.size() > 0){
+        length = pose_.back().frame + 1;
+    }
+    if (event_.size() > 0){
+        length = std::max(length, event_.back().frame + 1);
+    }
+    return length;
+}
+
+} // namespace game
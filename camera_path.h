@@ -0,0 +1,68 @@
+#ifndef CAMERA_PATH_H_
+#define CAMERA_PATH_H_
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace game {
+
+    // Kinds of scripted events besides the poses
+    typedef enum PathEventType { KeyPathEvent, ZonePathEvent, BlockPathEvent } PathEventType;
+
+    // Scripted event of a path
+    struct PathEvent {
+        int frame;
+        PathEventType type;
+        int key; // GLFW key code of a key event
+        std::string name; // Zone or block name
+    };
+
+    // Walk through the game, frame by frame, for benchmarks
+    // A path file has one entry per line, "frame command arguments":
+    //
+    //   pose X Z YAW     player position on the ground and heading, radians
+    //   key K            press of a key: a letter or digit, or a GLFW code
+    //   zone NAME        move to the castle or the village
+    //   block NAME       block of the map the player is in
+    //
+    // Poses are keyframes: between two of them the player moves in a
+    // straight line and turns at a constant rate, and after the last one
+    // it stays put. Lines starting with '#' are comments
+    class CameraPath {
+
+        public:
+            CameraPath(void);
+
+            // Read a path; throws if the file cannot be read or has a bad
+            // line
+            void Load(std::string filename);
+            // Write the path in the same format
+            void Save(std::string filename) const;
+
+            // Add a pose or an event; frames must not decrease
+            void AddPose(int frame, glm::vec2 position, float yaw);
+            void AddEvent(const PathEvent &event);
+
+            // Pose of the player at a frame; false before the first pose
+            bool GetPose(int frame, glm::vec2 &position, float &yaw) const;
+            // Events of a frame, in file order
+            void GetEvents(int frame, std::vector<PathEvent> &events) const;
+            // Number of frames up to the last pose or event
+            int GetLength(void) const;
+
+        private:
+            struct Pose {
+                int frame;
+                glm::vec2 position;
+                float yaw;
+            };
+
+            std::vector<Pose> pose_; // By frame
+            std::vector<PathEvent> event_; // By frame
+
+    }; // class CameraPath
+
+} // namespace game
+
+#endif // CAMERA_PATH_H_
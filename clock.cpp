@@ -0,0 +1,45 @@
+#include <chrono>
+#include <GLFW/glfw3.h>
+
+#include "clock.h"
+
+namespace game {
+
+double Clock::step_ = 0.0;
+double Clock::time_ = 0.0;
+
+// Start of the wall time
+static const std::chrono::steady_clock::time_point start_g = std::chrono::steady_clock::now();
+
+
+double Clock::GetTime(void){
+
+    if (step_ > 0.0){
+        return time_;
+    }
+    return glfwGetTime();
+}
+
+
+void Clock::SetStep(double step){
+
+    // Carry on from the current time
+    time_ = GetTime();
+    step_ = step;
+}
+
+
+void Clock::Tick(void){
+
+    if (step_ > 0.0){
+        time_ += step_;
+    }
+}
+
+
+double Clock::GetWallTime(void){
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_g).count();
+}
+
+} // namespace game
@@ -0,0 +1,33 @@
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+namespace game {
+
+    // Time sources of the game, in seconds
+    // Game time drives the animation and the shaders. It normally follows
+    // GLFW; when stepped, it advances by a fixed amount per frame instead,
+    // so runs without a display need no window library and give the same
+    // frames every time. Wall time is for measuring, and never stepped
+    class Clock {
+
+        public:
+            // Game time
+            static double GetTime(void);
+            // Advance the game time by 'step' per frame from now on; zero
+            // to follow GLFW again
+            static void SetStep(double step);
+            // End of a frame
+            static void Tick(void);
+
+            // Time since the program started
+            static double GetWallTime(void);
+
+        private:
+            static double step_;
+            static double time_; // Game time when stepped
+
+    }; // class Clock
+
+} // namespace game
+
+#endif // CLOCK_H_
@@ -0,0 +1,885 @@
+#include <algorithm>
+#include <cstring>
+
+#include "draw_queue.h"
+#include "program_info.h"
+#include "frame_constants.h"
+#include "clock.h"
+#include "profiler.h"
+
+namespace game {
+
+// Number of bits of each field of the draw key
+#define KEY_LAYER_BITS 2
+#define KEY_PROGRAM_BITS 12
+#define KEY_TEXTURE_BITS 12
+#define KEY_GEOMETRY_BITS 14
+#define KEY_DEPTH_BITS 24
+
+// Above this number of new nodes a full sort is cheaper than insertion
+#define MAX_INSERTION_SORT_ADDS 32
+
+// Smallest batch worth an instanced draw call
+#define MIN_INSTANCE_COUNT 2
+// Floats per instance: world matrix, normal matrix (3x3) and position
+#define INSTANCE_FLOATS (16 + 9 + 3)
+// Floats of uniforms per single draw: world matrix, normal matrix and
+// position
+#define UNIFORM_FLOATS (16 + 16 + 3)
+// Queue items per command list when recording in parallel
+#define RECORD_GRAIN 64
+
+// Storage buffer bindings and work group size of the culling program
+#define NODE_TRANSFORMS_BINDING 0
+#define NODE_DRAWS_BINDING 1
+#define DRAW_COMMANDS_BINDING 2
+#define CULL_GROUP_SIZE 64
+// Size of a DrawElementsIndirectCommand
+#define DRAW_COMMAND_SIZE (5 * sizeof(GLuint))
+// Frames before the triangle count of the GPU draws is read
+#define TRIANGLE_QUERY_LATENCY 3
+
+
+DrawQueue::DrawQueue(void){
+
+    added_ = 0;
+    culled_ = false;
+    prepared_ = false;
+    memset(&stats_, 0, sizeof(stats_));
+    frame_constants_buffer_ = 0;
+    streaming_ = -1;
+    uniform_alignment_ = 0;
+    instancing_ = -1;
+    instance_buffer_ = 0;
+    jobs_ = NULL;
+    cull_program_ = 0;
+    indirect_changed_ = true;
+    arena_version_ = -1;
+    transform_buffer_ = 0;
+    node_draw_buffer_ = 0;
+    command_buffer_ = 0;
+    indirect_triangles_ = 0;
+}
+
+
+DrawQueue::~DrawQueue(){
+
+    if (instance_buffer_){
+        glDeleteBuffers(1, &instance_buffer_);
+    }
+    if (frame_constants_buffer_){
+        glDeleteBuffers(1, &frame_constants_buffer_);
+    }
+    if (transform_buffer_){
+        glDeleteBuffers(1, &transform_buffer_);
+        glDeleteBuffers(1, &node_draw_buffer_);
+        glDeleteBuffers(1, &command_buffer_);
+    }
+}
+
+
+void DrawQueue::Add(SceneNode *node){
+
+    Item item;
+    item.key = 0;
+    item.node = node;
+    item_.push_back(item);
+    added_++;
+    indirect_changed_ = true;
+}
+
+
+void DrawQueue::Remove(SceneNode *node){
+
+    for (int i = 0; i < item_.size(); i++){
+        if (item_[i].node == node){
+            item_.erase(item_.begin() + i);
+            indirect_changed_ = true;
+            return;
+        }
+    }
+}
+
+
+uint64_t DrawQueue::MakeKey(const SceneNode *node, glm::vec3 eye){
+
+    // Squared distance to the viewer; the bits of a non-negative float sort
+    // like the float itself, so the top bits are a usable depth. Child
+    // nodes only know their position relative to the parent, so take it
+    // from the cached world matrix
+    glm::vec3 d = glm::vec3(node->GetWorldTransform()[3]) - eye;
+    float dist = glm::dot(d, d);
+    uint32_t bits;
+    memcpy(&bits, &dist, sizeof(bits));
+    uint64_t depth = bits >> (32 - KEY_DEPTH_BITS);
+
+    uint64_t layer = node->GetLayer();
+    uint64_t program = node->GetMaterial() & ((1 << KEY_PROGRAM_BITS) - 1);
+    uint64_t texture = node->GetTexture() & ((1 << KEY_TEXTURE_BITS) - 1);
+    uint64_t geometry = node->GetGeometry()->GetGeometryIndex() & ((1 << KEY_GEOMETRY_BITS) - 1);
+    uint64_t state = (program << (KEY_TEXTURE_BITS + KEY_GEOMETRY_BITS)) | (texture << KEY_GEOMETRY_BITS) | geometry;
+
+    uint64_t key = layer << (64 - KEY_LAYER_BITS);
+    if (layer == BlendedLayer || layer == ParticleLayer){
+        // Back to front
+        depth = ((uint64_t) 1 << KEY_DEPTH_BITS) - 1 - depth;
+        key |= (depth << (64 - KEY_LAYER_BITS - KEY_DEPTH_BITS)) | state;
+    } else {
+        // By state, then front to back
+        key |= (state << KEY_DEPTH_BITS) | depth;
+    }
+    return key;
+}
+
+
+void DrawQueue::Sort(glm::vec3 eye){
+
+    // Refresh the keys: nodes move and can change texture or layer
+    bool changed = false;
+    for (int i = 0; i < item_.size(); i++){
+        uint64_t key = MakeKey(item_[i].node, eye);
+        if (key != item_[i].key){
+            if (GetKeyState(key) != GetKeyState(item_[i].key)){
+                indirect_changed_ = true;
+            }
+            item_[i].key = key;
+            changed = true;
+        }
+    }
+    if (!changed && added_ == 0){
+        return;
+    }
+
+    if (added_ > MAX_INSERTION_SORT_ADDS){
+        std::stable_sort(item_.begin(), item_.end(), [](const Item &a, const Item &b){
+            return a.key < b.key;
+        });
+    } else {
+        // The previous order is nearly right from one frame to the next,
+        // so insertion sort only does a few moves
+        for (int i = 1; i < item_.size(); i++){
+            Item item = item_[i];
+            int j = i - 1;
+            while (j >= 0 && item_[j].key > item.key){
+                item_[j + 1] = item_[j];
+                j--;
+            }
+            item_[j + 1] = item;
+        }
+    }
+    added_ = 0;
+}
+
+
+uint64_t DrawQueue::GetKeyState(uint64_t key){
+
+    // Clear the depth bits
+    uint64_t layer = key >> (64 - KEY_LAYER_BITS);
+    uint64_t depth_mask = (((uint64_t) 1 << KEY_DEPTH_BITS) - 1);
+    if (layer == BlendedLayer || layer == ParticleLayer){
+        depth_mask <<= (64 - KEY_LAYER_BITS - KEY_DEPTH_BITS);
+    }
+    return key & ~depth_mask;
+}
+
+
+void DrawQueue::Cull(const std::vector<unsigned char> &visible){
+
+    int count = item_.size();
+    visible_.resize(count);
+
+    stats_.visible = 0;
+    for (int i = 0; i < count; i++){
+        SceneNode *node = item_[i].node;
+        visible_[i] = !node->GetCullable() || visible[node->GetHandle().index];
+        stats_.visible += visible_[i];
+    }
+    stats_.culled = count - stats_.visible;
+    culled_ = true;
+}
+
+
+void DrawQueue::SetupLayer(RenderLayer layer){
+
+    switch (layer){
+        case SkyLayer:
+            // Drawn behind everything else, without depth test
+            glDisable(GL_DEPTH_TEST);
+            glDepthMask(GL_TRUE);
+            glDisable(GL_BLEND);
+            break;
+        case OpaqueLayer:
+            // Z-buffer
+            glEnable(GL_DEPTH_TEST);
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+            glDisable(GL_BLEND);
+            break;
+        case BlendedLayer:
+        case ParticleLayer:
+            // Tested against the z-buffer without writing to it
+            glEnable(GL_DEPTH_TEST);
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_FALSE);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            break;
+    }
+}
+
+
+void DrawQueue::Prepare(Camera *camera, Light *light){
+
+    stats_.draws = 0;
+    stats_.programs = 0;
+    stats_.textures = 0;
+    stats_.buffers = 0;
+    stats_.instanced = 0;
+    stats_.indirect = 0;
+    stats_.stalls = 0;
+    stats_.lists = 0;
+    stats_.triangles = 0;
+    if (!culled_){
+        stats_.visible = item_.size();
+        stats_.culled = 0;
+    }
+
+    if (instancing_ == -1){
+        instancing_ = (GLEW_VERSION_3_3 || GLEW_ARB_instanced_arrays) ? 1 : 0;
+        if (instancing_){
+            glGenBuffers(1, &instance_buffer_);
+        }
+    }
+
+    if (streaming_ == -1){
+        streaming_ = GLEW_ARB_buffer_storage ? 1 : 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_alignment_);
+    }
+    if (streaming_){
+        int stalls = stream_.GetStalls();
+        stream_.BeginFrame();
+        stats_.stalls = stream_.GetStalls() - stalls;
+    }
+
+    SetupFrameConstants(camera, light);
+
+    // The GPU culls its nodes up front; they are drawn when the replay
+    // reaches the opaque layer, and are not recorded
+    if (cull_program_){
+        CullIndirect(camera);
+    }
+
+    Record();
+    UploadInstances();
+    prepared_ = true;
+}
+
+
+void DrawQueue::Submit(void){
+
+    if (!prepared_){
+        return;
+    }
+    Replay();
+
+    // Restore default state
+    glBindVertexArray(0);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+
+    if (streaming_){
+        stream_.EndFrame();
+    }
+
+    // The cull result is only valid for this frame
+    culled_ = false;
+    prepared_ = false;
+}
+
+
+void DrawQueue::SetupFrameConstants(Camera *camera, Light *light){
+
+    FrameConstants constants;
+    constants.pad0 = constants.pad1 = 0.0;
+    constants.view_mat = camera->GetViewMatrix();
+    constants.projection_mat = camera->GetProjectionMatrix();
+    constants.view_position = camera->GetPosition();
+    constants.light_position = light->GetPosition();
+    constants.light_color = light->GetColor();
+    constants.timer = (float) Clock::GetTime();
+
+    if (streaming_){
+        GLintptr offset;
+        void *data = stream_.Allocate(sizeof(constants), uniform_alignment_, offset);
+        memcpy(data, &constants, sizeof(constants));
+        glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_CONSTANTS_BINDING, stream_.GetBuffer(), offset, sizeof(constants));
+        return;
+    }
+
+    if (!frame_constants_buffer_){
+        glGenBuffers(1, &frame_constants_buffer_);
+        glBindBuffer(GL_UNIFORM_BUFFER, frame_constants_buffer_);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(constants), NULL, GL_DYNAMIC_DRAW);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, frame_constants_buffer_);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(constants), &constants);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_CONSTANTS_BINDING, frame_constants_buffer_);
+}
+
+
+bool DrawQueue::SameBatch(const SceneNode *a, const SceneNode *b){
+
+    return a->GetLayer() == b->GetLayer() &&
+           a->GetMaterial() == b->GetMaterial() &&
+           a->GetTexture() == b->GetTexture() &&
+           a->GetGeometry() == b->GetGeometry() &&
+           a->GetMode() == b->GetMode() &&
+           a->GetMode() != GL_POINTS;
+}
+
+
+int DrawQueue::FindBatch(int first, int last, int &end) const {
+
+    // The sort puts nodes with the same state next to each other; culled
+    // nodes in between are skipped
+    const SceneNode *node = item_[first].node;
+    int count = 1;
+    end = first + 1;
+    while (end < last){
+        if (culled_ && !visible_[end]){
+            end++;
+            continue;
+        }
+        if (!SameBatch(node, item_[end].node)){
+            break;
+        }
+        count++;
+        end++;
+    }
+    return count;
+}
+
+
+void DrawQueue::SetupInstanceAttribute(GLint att, int columns, int rows, int offset, GLintptr base){
+
+    if (att < 0){
+        return;
+    }
+    // A matrix takes one attribute location per column
+    for (int c = 0; c < columns; c++){
+        glVertexAttribPointer(att + c, rows, GL_FLOAT, GL_FALSE, INSTANCE_FLOATS * sizeof(GLfloat), (void *) (base + (offset + c * rows) * sizeof(GLfloat)));
+        glEnableVertexAttribArray(att + c);
+        glVertexAttribDivisor(att + c, 1);
+    }
+}
+
+
+void DrawQueue::PackInstance(const SceneNode *node, GLfloat *data){
+
+    glm::mat4 world = node->GetWorldTransform();
+    glm::mat4 normal = node->GetNormalMatrix();
+    glm::vec3 position = node->GetPosition();
+    memcpy(data, &world[0][0], 16 * sizeof(GLfloat));
+    for (int c = 0; c < 3; c++){
+        data[16 + c * 3 + 0] = normal[c][0];
+        data[16 + c * 3 + 1] = normal[c][1];
+        data[16 + c * 3 + 2] = normal[c][2];
+    }
+    data[25] = position.x;
+    data[26] = position.y;
+    data[27] = position.z;
+}
+
+
+void DrawQueue::Record(void){
+
+    ProfileZone zone("DrawQueue::Record");
+
+    // Ranges of about the same size; a range ends where a batch does, so
+    // no batch is split between lists
+    int count = item_.size();
+    int num_lists = 1;
+    if (jobs_){
+        num_lists = std::max(1, (count + RECORD_GRAIN - 1) / RECORD_GRAIN);
+    }
+    list_start_.clear();
+    list_start_.push_back(0);
+    for (int i = 1; i < num_lists; i++){
+        int start = std::max(list_start_.back(), i * count / num_lists);
+        while (start > 0 && start < count && SameBatch(item_[start - 1].node, item_[start].node)){
+            start++;
+        }
+        list_start_.push_back(start);
+    }
+    list_start_.push_back(count);
+
+    if (list_.size() < num_lists){
+        list_.resize(num_lists);
+    }
+    stats_.lists = num_lists;
+
+    // The scene graph composes all transforms before drawing, so the
+    // recording threads only read the nodes
+    std::function<void(int, int)> body = [this](int begin, int end){
+        for (int i = begin; i < end; i++){
+            RecordRange(list_start_[i], list_start_[i + 1], list_[i]);
+        }
+    };
+    if (jobs_ && num_lists > 1){
+        jobs_->ParallelFor(num_lists, 1, body);
+    } else {
+        body(0, num_lists);
+    }
+}
+
+
+void DrawQueue::RecordRange(int first, int end, CommandList &list) const {
+
+    ProfileZone zone("DrawQueue::RecordRange");
+
+    list.command.clear();
+    list.uniform.clear();
+    list.instance.clear();
+
+    for (int i = first; i < end; i++){
+        SceneNode *node = item_[i].node;
+        if ((culled_ && !visible_[i]) || IsIndirect(node)){
+            continue;
+        }
+
+        // Nodes drawn together with this one, if any
+        int batch_end = i + 1;
+        int count = 1;
+        if (instancing_ && node->GetInstancedMaterial()){
+            count = FindBatch(i, end, batch_end);
+        }
+        bool instanced = (count >= MIN_INSTANCE_COUNT);
+
+        const Resource *geometry = node->GetGeometry();
+        Command command;
+        command.layer = node->GetLayer();
+        command.program = instanced ? node->GetInstancedMaterial() : node->GetMaterial();
+        command.vertex_array = instanced ? node->GetInstancedVertexArray() : node->GetVertexArray();
+        command.texture = node->GetTexture();
+        command.mode = node->GetMode();
+        command.count = node->GetSize();
+        command.first = (command.mode == GL_POINTS) ? geometry->GetBaseVertex() : geometry->GetFirstIndex();
+        command.base_vertex = geometry->GetBaseVertex();
+
+        if (instanced){
+            command.instances = count;
+            command.data = list.instance.size();
+            list.instance.resize(command.data + count * INSTANCE_FLOATS);
+            GLfloat *data = &list.instance[command.data];
+            for (int j = i; j < batch_end; j++){
+                if (culled_ && !visible_[j]){
+                    continue;
+                }
+                PackInstance(item_[j].node, data);
+                data += INSTANCE_FLOATS;
+            }
+            i = batch_end - 1;
+        } else {
+            command.instances = 0;
+            command.data = list.uniform.size();
+            list.uniform.resize(command.data + UNIFORM_FLOATS);
+            GLfloat *data = &list.uniform[command.data];
+            glm::mat4 world = node->GetWorldTransform();
+            glm::mat4 normal = node->GetNormalMatrix();
+            glm::vec3 position = node->GetPosition();
+            memcpy(data, &world[0][0], 16 * sizeof(GLfloat));
+            memcpy(data + 16, &normal[0][0], 16 * sizeof(GLfloat));
+            memcpy(data + 32, &position[0], 3 * sizeof(GLfloat));
+        }
+        list.command.push_back(command);
+    }
+}
+
+
+void DrawQueue::UploadInstances(void){
+
+    int num_lists = list_start_.size() - 1;
+    if (streaming_){
+        // Each list is copied to the ring once; earlier ranges stay valid
+        // for the frame if a later allocation grows it
+        for (int i = 0; i < num_lists; i++){
+            CommandList &list = list_[i];
+            if (list.instance.size() == 0){
+                continue;
+            }
+            GLsizeiptr size = list.instance.size() * sizeof(GLfloat);
+            void *data = stream_.Allocate(size, sizeof(GLfloat), list.base);
+            memcpy(data, &list.instance[0], size);
+            list.buffer = stream_.GetBuffer();
+        }
+        return;
+    }
+
+    // One update of the instance buffer for all the lists
+    GLsizeiptr total = 0;
+    for (int i = 0; i < num_lists; i++){
+        total += list_[i].instance.size() * sizeof(GLfloat);
+    }
+    if (total == 0){
+        return;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_);
+    glBufferData(GL_ARRAY_BUFFER, total, NULL, GL_STREAM_DRAW);
+    GLintptr offset = 0;
+    for (int i = 0; i < num_lists; i++){
+        CommandList &list = list_[i];
+        GLsizeiptr size = list.instance.size() * sizeof(GLfloat);
+        if (size > 0){
+            glBufferSubData(GL_ARRAY_BUFFER, offset, size, &list.instance[0]);
+        }
+        list.buffer = instance_buffer_;
+        list.base = offset;
+        offset += size;
+    }
+}
+
+
+void DrawQueue::Replay(void){
+
+    ProfileZone zone("DrawQueue::Replay");
+
+    // Current state; zero is never a valid program or buffer
+    int layer = -1;
+    GLuint program = 0;
+    GLuint vertex_array = 0;
+    GLuint texture = 0;
+    bool indirect = (cull_program_ != 0);
+
+    int num_lists = list_start_.size() - 1;
+    for (int l = 0; l < num_lists; l++){
+        const CommandList &list = list_[l];
+        for (int i = 0; i < list.command.size(); i++){
+            const Command &command = list.command[i];
+            if (indirect && command.layer >= OpaqueLayer){
+                layer = OpaqueLayer;
+                SetupLayer(OpaqueLayer);
+                DrawIndirect();
+                indirect = false;
+                // The groups leave their own state bound
+                program = 0;
+                vertex_array = 0;
+                texture = 0;
+            }
+
+            if (command.layer != layer){
+                layer = command.layer;
+                SetupLayer(command.layer);
+            }
+
+            // Camera, light and time come from the frame constants, so a
+            // new program needs no uniforms of its own
+            if (command.program != program){
+                program = command.program;
+                glUseProgram(program);
+                stats_.programs++;
+            }
+
+            // The vertex array holds the buffers and attribute layout of
+            // the geometry for this program
+            if (command.vertex_array != vertex_array){
+                vertex_array = command.vertex_array;
+                glBindVertexArray(vertex_array);
+                stats_.buffers++;
+            }
+
+            // Texture, bound to the first texture unit; interpolation is
+            // set up when the texture is loaded
+            const ProgramInfo &info = ProgramInfo::Get(program);
+            if (command.texture){
+                if (command.texture != texture){
+                    texture = command.texture;
+                    glActiveTexture(GL_TEXTURE0);
+                    glBindTexture(GL_TEXTURE_2D, texture);
+                    stats_.textures++;
+                }
+                glUniform1i(info.GetUniform(TextureMapUniform), 0);
+            }
+
+            if (command.instances > 0){
+                GLintptr base = list.base + command.data * sizeof(GLfloat);
+                glBindBuffer(GL_ARRAY_BUFFER, list.buffer);
+                SetupInstanceAttribute(info.GetAttribute(InstanceWorldMatAttribute), 4, 4, 0, base);
+                SetupInstanceAttribute(info.GetAttribute(InstanceNormalMatAttribute), 3, 3, 16, base);
+                SetupInstanceAttribute(info.GetAttribute(InstancePositionAttribute), 1, 3, 25, base);
+                glDrawElementsInstancedBaseVertex(command.mode, command.count, GL_UNSIGNED_INT, (void *) (command.first * sizeof(GLuint)), command.instances, command.base_vertex);
+                stats_.instanced += command.instances;
+                if (command.mode == GL_TRIANGLES){
+                    stats_.triangles += command.count / 3 * command.instances;
+                }
+            } else {
+                const GLfloat *data = &list.uniform[command.data];
+                glUniformMatrix4fv(info.GetUniform(WorldMatUniform), 1, GL_FALSE, data);
+                glUniformMatrix4fv(info.GetUniform(NormalMatUniform), 1, GL_FALSE, data + 16);
+                glUniform3fv(info.GetUniform(PositionUniform), 1, data + 32);
+                if (command.mode == GL_POINTS){
+                    glDrawArrays(command.mode, command.first, command.count);
+                } else {
+                    glDrawElementsBaseVertex(command.mode, command.count, GL_UNSIGNED_INT, (void *) (command.first * sizeof(GLuint)), command.base_vertex);
+                }
+                if (command.mode == GL_TRIANGLES){
+                    stats_.triangles += command.count / 3;
+                }
+            }
+            stats_.draws++;
+        }
+    }
+
+    // Nothing but sky in the queue
+    if (indirect){
+        SetupLayer(OpaqueLayer);
+        DrawIndirect();
+    }
+}
+
+
+void DrawQueue::Move(int index){
+
+    if (cull_program_ && index < indirect_slot_.size() && indirect_slot_[index] >= 0){
+        indirect_moved_.push_back(indirect_slot_[index]);
+    }
+}
+
+
+void DrawQueue::SetJobSystem(JobSystem *jobs){
+
+    jobs_ = jobs;
+}
+
+
+void DrawQueue::SetCullProgram(GLuint program){
+
+    cull_program_ = program;
+    indirect_changed_ = true;
+}
+
+
+GLuint DrawQueue::GetCullProgram(void) const {
+
+    return cull_program_;
+}
+
+
+bool DrawQueue::IsIndirect(const SceneNode *node) const {
+
+    return cull_program_ && indirect_slot_[node->GetHandle().index] >= 0;
+}
+
+
+void DrawQueue::BuildIndirect(void){
+
+    // Opaque nodes with an instanced program; the sky, blended and
+    // particle nodes, and materials without an instanced variant, stay on
+    // the CPU
+    indirect_node_.clear();
+    int capacity = 0;
+    for (int i = 0; i < item_.size(); i++){
+        SceneNode *node = item_[i].node;
+        capacity = std::max(capacity, (int) node->GetHandle().index + 1);
+        if (node->GetLayer() == OpaqueLayer && node->GetInstancedMaterial() && node->GetMode() != GL_POINTS){
+            indirect_node_.push_back(node);
+        }
+    }
+
+    // Nodes that can share a draw call get consecutive slots
+    std::stable_sort(indirect_node_.begin(), indirect_node_.end(), [](const SceneNode *a, const SceneNode *b){
+        if (a->GetInstancedMaterial() != b->GetInstancedMaterial()){
+            return a->GetInstancedMaterial() < b->GetInstancedMaterial();
+        }
+        if (a->GetTexture() != b->GetTexture()){
+            return a->GetTexture() < b->GetTexture();
+        }
+        if (a->GetInstancedVertexArray() != b->GetInstancedVertexArray()){
+            return a->GetInstancedVertexArray() < b->GetInstancedVertexArray();
+        }
+        return a->GetMode() < b->GetMode();
+    });
+
+    int count = indirect_node_.size();
+    indirect_slot_.assign(capacity, -1);
+    indirect_group_.clear();
+    indirect_transform_.resize(count * INSTANCE_FLOATS);
+    std::vector<IndirectDraw> draw(count);
+    for (int i = 0; i < count; i++){
+        SceneNode *node = indirect_node_[i];
+        indirect_slot_[node->GetHandle().index] = i;
+        PackInstance(node, &indirect_transform_[i * INSTANCE_FLOATS]);
+
+        const Resource *geometry = node->GetGeometry();
+        draw[i].count = node->GetSize();
+        draw[i].first_index = geometry->GetFirstIndex();
+        draw[i].base_vertex = geometry->GetBaseVertex();
+        draw[i].radius = geometry->GetBoundRadius();
+
+        IndirectGroup *group = indirect_group_.size() > 0 ? &indirect_group_.back() : NULL;
+        if (!group ||
+            group->program != node->GetInstancedMaterial() ||
+            group->texture != node->GetTexture() ||
+            group->vertex_array != node->GetInstancedVertexArray() ||
+            group->mode != node->GetMode()){
+            IndirectGroup next;
+            next.program = node->GetInstancedMaterial();
+            next.vertex_array = node->GetInstancedVertexArray();
+            next.texture = node->GetTexture();
+            next.mode = node->GetMode();
+            next.first = i;
+            next.count = 0;
+            indirect_group_.push_back(next);
+            group = &indirect_group_.back();
+        }
+        group->count++;
+    }
+
+    if (!transform_buffer_){
+        glGenBuffers(1, &transform_buffer_);
+        glGenBuffers(1, &node_draw_buffer_);
+        glGenBuffers(1, &command_buffer_);
+    }
+    if (count > 0){
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, transform_buffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, indirect_transform_.size() * sizeof(GLfloat), &indirect_transform_[0], GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, node_draw_buffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, draw.size() * sizeof(IndirectDraw), &draw[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, command_buffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, count * DRAW_COMMAND_SIZE, NULL, GL_DYNAMIC_COPY);
+        arena_version_ = indirect_node_[0]->GetGeometry()->GetArenaVersion();
+    }
+
+    // All transforms were just uploaded
+    indirect_moved_.clear();
+    indirect_changed_ = false;
+}
+
+
+void DrawQueue::CullIndirect(Camera *camera){
+
+    // The geometry ranges change when the arena is compacted
+    if (indirect_node_.size() > 0 && indirect_node_[0]->GetGeometry()->GetArenaVersion() != arena_version_){
+        indirect_changed_ = true;
+    }
+
+    if (indirect_changed_){
+        BuildIndirect();
+    } else if (indirect_moved_.size() > 0){
+        // One upload for the range of slots that moved; a slot can move
+        // more than once between frames, but is packed once
+        std::sort(indirect_moved_.begin(), indirect_moved_.end());
+        indirect_moved_.erase(std::unique(indirect_moved_.begin(), indirect_moved_.end()), indirect_moved_.end());
+        int first = indirect_node_.size();
+        int last = -1;
+        for (int i = 0; i < indirect_moved_.size(); i++){
+            int slot = indirect_moved_[i];
+            PackInstance(indirect_node_[slot], &indirect_transform_[slot * INSTANCE_FLOATS]);
+            first = std::min(first, slot);
+            last = std::max(last, slot);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, transform_buffer_);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * INSTANCE_FLOATS * sizeof(GLfloat), (last - first + 1) * INSTANCE_FLOATS * sizeof(GLfloat), &indirect_transform_[first * INSTANCE_FLOATS]);
+        indirect_moved_.clear();
+    }
+
+    int count = indirect_node_.size();
+    stats_.indirect = count;
+    if (count == 0){
+        return;
+    }
+
+    Frustum frustum = camera->GetFrustum();
+    glm::vec4 plane[6];
+    for (int i = 0; i < 6; i++){
+        plane[i] = frustum.GetPlane((Frustum::FrustumPlane) i);
+    }
+
+    glUseProgram(cull_program_);
+    const ProgramInfo &info = ProgramInfo::Get(cull_program_);
+    glUniform4fv(info.GetUniform(FrustumPlanesUniform), 6, &plane[0][0]);
+    glUniform1ui(info.GetUniform(NodeCountUniform), count);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODE_TRANSFORMS_BINDING, transform_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODE_DRAWS_BINDING, node_draw_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_COMMANDS_BINDING, command_buffer_);
+    glDispatchCompute((count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+    // The draws read the commands as indirect arguments
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+}
+
+
+void DrawQueue::DrawIndirect(void){
+
+    // Only the GPU knows which nodes it kept, so a query counts the
+    // triangles of the draws
+    GLuint query;
+    if (free_triangle_query_.size() > 0){
+        query = free_triangle_query_.back();
+        free_triangle_query_.pop_back();
+    } else {
+        glGenQueries(1, &query);
+    }
+    glBeginQuery(GL_PRIMITIVES_GENERATED, query);
+
+    GLuint program = 0;
+    GLuint texture = 0;
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer_);
+    for (int i = 0; i < indirect_group_.size(); i++){
+        const IndirectGroup &group = indirect_group_[i];
+        if (group.program != program){
+            program = group.program;
+            glUseProgram(program);
+            stats_.programs++;
+        }
+        glBindVertexArray(group.vertex_array);
+        stats_.buffers++;
+        if (group.texture && group.texture != texture){
+            texture = group.texture;
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            stats_.textures++;
+        }
+
+        // The instance of each command is the slot of its node, so the
+        // instance attributes read the transform of that node
+        const ProgramInfo &info = ProgramInfo::Get(program);
+        glBindBuffer(GL_ARRAY_BUFFER, transform_buffer_);
+        SetupInstanceAttribute(info.GetAttribute(InstanceWorldMatAttribute), 4, 4, 0);
+        SetupInstanceAttribute(info.GetAttribute(InstanceNormalMatAttribute), 3, 3, 16);
+        SetupInstanceAttribute(info.GetAttribute(InstancePositionAttribute), 1, 3, 25);
+        if (group.texture){
+            glUniform1i(info.GetUniform(TextureMapUniform), 0);
+        }
+
+        glMultiDrawElementsIndirect(group.mode, GL_UNSIGNED_INT, (void *) (group.first * DRAW_COMMAND_SIZE), group.count, 0);
+        stats_.draws++;
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    // Read the queries a few frames old rather than wait for this one;
+    // they finish in order, so stop at the first that is not ready
+    glEndQuery(GL_PRIMITIVES_GENERATED);
+    triangle_query_.push_back(query);
+    while (triangle_query_.size() > TRIANGLE_QUERY_LATENCY){
+        GLuint oldest = triangle_query_.front();
+        GLint available = 0;
+        glGetQueryObjectiv(oldest, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available){
+            break;
+        }
+        GLuint triangles = 0;
+        glGetQueryObjectuiv(oldest, GL_QUERY_RESULT, &triangles);
+        indirect_triangles_ = triangles;
+        free_triangle_query_.push_back(oldest);
+        triangle_query_.pop_front();
+    }
+    stats_.triangles += indirect_triangles_;
+}
+
+
+const DrawStats &DrawQueue::GetStats(void) const {
+
+    return stats_;
+}
+
+} // namespace game
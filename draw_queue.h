@@ -0,0 +1,262 @@
+#ifndef DRAW_QUEUE_H_
+#define DRAW_QUEUE_H_
+
+#include <vector>
+#include <deque>
+#include <stdint.h>
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "scene_node.h"
+#include "ring_buffer.h"
+#include "job_system.h"
+#include "camera.h"
+#include "light.h"
+
+namespace game {
+
+    // Culling results, state changes and draw calls of one frame
+    struct DrawStats {
+        int visible;
+        int culled;
+        int draws;
+        int programs;
+        int textures;
+        int buffers; // Vertex array binds
+        int instanced; // Nodes drawn by instanced draw calls
+        int indirect; // Nodes culled and drawn by the GPU
+        int stalls; // Waits for the GPU to release streaming memory
+        int lists; // Command lists recorded
+        // Triangles drawn; those of the nodes drawn by the GPU are counted
+        // by a query and read a few frames late
+        int triangles;
+    };
+
+    // Scene nodes sorted on a packed 64-bit key, so that nodes sharing a
+    // program, texture and geometry are drawn one after the other
+    //
+    // Key layout, from the most significant bit:
+    //   sky, opaque:         layer(2) program(12) texture(12) geometry(14) depth(24)
+    //   blended, particles:  layer(2) far-to-near depth(24) program(12) texture(12) geometry(14)
+    // Opaque nodes are drawn front to back within a state group; blended
+    // nodes are ordered back to front first and by state second
+    //
+    // Consecutive visible nodes with the same geometry, material and texture
+    // are drawn with one instanced draw call when the material has an
+    // instanced variant; their world matrices go to an instance buffer
+    //
+    // With a culling program set, the opaque nodes whose material has an
+    // instanced variant are drawn by the GPU instead: their transforms and
+    // bounds stay in storage buffers, updated only for the nodes that
+    // move, a compute shader culls them against the frustum and writes a
+    // draw command per node, and each group of nodes with the same program,
+    // texture and vertex array is one multi-draw indirect call
+    //
+    // A frame is recorded first and drawn second. Recording walks the
+    // queue in ranges, one command list per range, and packs the uniforms
+    // and instance inputs of every draw without touching GL, so with a job
+    // system the ranges are recorded by worker threads. The lists are then
+    // replayed in order on the GL thread. They hold everything the draws
+    // need, so the replay reads no node, and the scene can be updated for
+    // the next frame while it runs
+    class DrawQueue {
+
+        public:
+            DrawQueue(void);
+            ~DrawQueue();
+
+            // Add or remove a node
+            void Add(SceneNode *node);
+            void Remove(SceneNode *node);
+
+            // Recompute the keys for a viewer at 'eye' and restore the
+            // order. The order of the previous frame is kept, so a scene
+            // that did not change is not sorted again
+            void Sort(glm::vec3 eye);
+
+            // Set which nodes the next Submit draws, from their visibility
+            // indexed by node handle index
+            // Nodes that cannot be culled are always drawn
+            void Cull(const std::vector<unsigned char> &visible);
+
+            // Write the frame constants for 'camera' and 'light' and
+            // record the draws of the nodes in key order; the last access
+            // to the nodes for the frame, so they can change afterwards
+            void Prepare(Camera *camera, Light *light);
+            // Issue the recorded draws, setting up each render layer and
+            // skipping redundant program, buffer and texture binds
+            void Submit(void);
+
+            // Mark the transformation of the node with handle index 'index'
+            // as changed since the last submit
+            void Move(int index);
+
+            // Job system that records the command lists; NULL to record
+            // on the calling thread
+            void SetJobSystem(JobSystem *jobs);
+
+            // Compute program that culls the nodes drawn by the GPU; zero
+            // to draw every node from the CPU. Needs OpenGL 4.3
+            void SetCullProgram(GLuint program);
+            GLuint GetCullProgram(void) const;
+
+            // Statistics of the last submission
+            const DrawStats &GetStats(void) const;
+
+            // Build the draw key of a node seen from 'eye'
+            static uint64_t MakeKey(const SceneNode *node, glm::vec3 eye);
+
+        private:
+            struct Item {
+                uint64_t key;
+                SceneNode *node;
+            };
+
+            // Geometry range and object-space bound radius of a node drawn
+            // by the GPU; matches NodeDraw in the culling program
+            struct IndirectDraw {
+                GLuint count;
+                GLuint first_index;
+                GLint base_vertex;
+                GLfloat radius;
+            };
+
+            // Draw call recorded for replay; 'instances' is zero for a
+            // single node, whose uniforms are at 'data' in the uniform data
+            // of the list, and otherwise the size of a batch, whose
+            // instance inputs are at 'data' in the instance data
+            struct Command {
+                RenderLayer layer;
+                GLuint program;
+                GLuint vertex_array;
+                GLuint texture;
+                GLenum mode;
+                GLsizei count;
+                GLint first; // First index, or first vertex for points
+                GLint base_vertex;
+                int instances;
+                int data;
+            };
+
+            // Commands recorded from one range of the queue
+            struct CommandList {
+                std::vector<Command> command;
+                std::vector<GLfloat> uniform;
+                std::vector<GLfloat> instance;
+                // Where the instance data was uploaded for the frame
+                GLuint buffer;
+                GLintptr base;
+            };
+
+            // Nodes drawn by the GPU with the same state, in consecutive
+            // slots
+            struct IndirectGroup {
+                GLuint program;
+                GLuint vertex_array;
+                GLuint texture;
+                GLenum mode;
+                int first;
+                int count;
+            };
+
+            // Nodes in draw order
+            std::vector<Item> item_;
+            // Number of nodes added since the last sort
+            int added_;
+
+            // Result of the last cull, in draw order
+            std::vector<unsigned char> visible_;
+            bool culled_;
+            // Whether draws were recorded since the last submit
+            bool prepared_;
+            DrawStats stats_;
+
+            // Uniform buffer of the frame constants, created on the first
+            // submit
+            GLuint frame_constants_buffer_;
+
+            // Streaming of the frame constants and instance data through
+            // a persistently mapped ring; support is checked on the first
+            // submit, and without it the data goes through buffer updates
+            int streaming_;
+            RingBuffer stream_;
+            GLint uniform_alignment_;
+
+            // Instanced drawing: support is checked on the first submit
+            int instancing_;
+            GLuint instance_buffer_;
+
+            // Recording; the lists keep their memory from frame to frame
+            JobSystem *jobs_;
+            std::vector<CommandList> list_;
+            std::vector<int> list_start_; // First item of each list
+
+            // GPU-driven drawing; the slots are reassigned when nodes are
+            // added or removed or change state
+            GLuint cull_program_;
+            bool indirect_changed_;
+            int arena_version_; // Version of the arena the ranges are from
+            std::vector<SceneNode *> indirect_node_; // Nodes by slot
+            std::vector<int> indirect_slot_; // Slots by handle index, -1 for nodes drawn by the CPU
+            std::vector<int> indirect_moved_; // Slots whose transform is out of date
+            std::vector<IndirectGroup> indirect_group_;
+            std::vector<GLfloat> indirect_transform_; // Copy of the transform buffer
+            GLuint transform_buffer_;
+            GLuint node_draw_buffer_;
+            GLuint command_buffer_;
+            // Queries counting the triangles the GPU kept, oldest first
+            std::deque<GLuint> triangle_query_;
+            std::vector<GLuint> free_triangle_query_;
+            int indirect_triangles_; // Result of the last query read
+
+            // Upload the constants shared by all programs for this frame
+            void SetupFrameConstants(Camera *camera, Light *light);
+            // Set depth and blending state for a render layer
+            static void SetupLayer(RenderLayer layer);
+            // Part of a key that does not depend on the viewer
+            static uint64_t GetKeyState(uint64_t key);
+            // Whether a node is drawn by the GPU
+            bool IsIndirect(const SceneNode *node) const;
+            // Assign slots to the nodes drawn by the GPU and upload their
+            // transforms and geometry ranges
+            void BuildIndirect(void);
+            // Bring the transforms up to date and write the draw commands
+            // of the nodes visible from 'camera'
+            void CullIndirect(Camera *camera);
+            // Draw the nodes of the GPU, one call per group; the opaque
+            // layer must be set up
+            void DrawIndirect(void);
+            // Whether two nodes can be drawn by the same instanced call
+            static bool SameBatch(const SceneNode *a, const SceneNode *b);
+            // Find the visible nodes of [first, last) that can be drawn
+            // with 'first'; returns their number and sets 'end' past the
+            // last one
+            int FindBatch(int first, int last, int &end) const;
+            // Split the queue into ranges and record a command list for
+            // each, in parallel when there is a job system
+            void Record(void);
+            // Record the draws of the items in [first, end) into a list;
+            // reads the nodes only, so lists can be recorded concurrently
+            void RecordRange(int first, int end, CommandList &list) const;
+            // Upload the instance data of all lists for this frame
+            void UploadInstances(void);
+            // Issue the recorded commands in order, skipping redundant
+            // binds, and draw the nodes of the GPU when the opaque layer
+            // starts
+            void Replay(void);
+            // Point an instance attribute of 'columns' columns of 'rows'
+            // floats at the buffer bound to GL_ARRAY_BUFFER, with the
+            // instances starting 'base' bytes in; 'att' is the location of
+            // the first column, -1 if the program has none. The pointers
+            // go into the vertex array of the instanced program, which
+            // per-node draws never bind
+            static void SetupInstanceAttribute(GLint att, int columns, int rows, int offset, GLintptr base = 0);
+            // Write the per-node inputs of an instanced program
+            static void PackInstance(const SceneNode *node, GLfloat *data);
+
+    }; // class DrawQueue
+
+} // namespace game
+
+#endif // DRAW_QUEUE_H_
@@ -0,0 +1,47 @@
+#ifndef FRAME_CONSTANTS_H_
+#define FRAME_CONSTANTS_H_
+
+#include <glm/glm.hpp>
+
+// Name of the uniform block in the shader programs and the binding point
+// it is attached to
+#define FRAME_CONSTANTS_BLOCK "FrameConstants"
+#define FRAME_CONSTANTS_BINDING 0
+
+// Declaration of the block, added to every shader stage when its program
+// is compiled, so the shaders do not declare it themselves
+#define FRAME_CONSTANTS_SOURCE \
+    "layout(std140) uniform FrameConstants {\n" \
+    "    mat4 view_mat;\n" \
+    "    mat4 projection_mat;\n" \
+    "    vec3 view_position;\n" \
+    "    vec3 light_position;\n" \
+    "    vec3 light_color;\n" \
+    "    float timer;\n" \
+    "};\n"
+// Uniform blocks are core from GLSL 1.40; older shaders need the extension
+#define FRAME_CONSTANTS_CORE_VERSION 140
+#define FRAME_CONSTANTS_EXTENSION "#extension GL_ARB_uniform_buffer_object : require\n"
+
+namespace game {
+
+    // Shader inputs that are the same for every node in a frame, written
+    // to a uniform buffer once per frame
+    // Mirrors the std140 layout of FRAME_CONSTANTS_SOURCE; a vec3 takes
+    // 16 bytes unless a float follows it
+    struct FrameConstants {
+        glm::mat4 view_mat;
+        glm::mat4 projection_mat;
+        glm::vec3 view_position;
+        float pad0;
+        glm::vec3 light_position;
+        float pad1;
+        glm::vec3 light_color;
+        float timer;
+    };
+
+    static_assert(sizeof(FrameConstants) == 176, "FrameConstants does not match the std140 layout");
+
+} // namespace game
+
+#endif // FRAME_CONSTANTS_H_
@@ -0,0 +1,152 @@
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FRUSTUM_AVX
+#endif
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FRUSTUM_SSE
+#endif
+
+#include "frustum.h"
+
+namespace game {
+
+Frustum::Frustum(void){
+
+    // Planes that accept everything
+    for (int i = 0; i < 6; i++){
+        plane_[i] = glm::vec4(0.0, 0.0, 0.0, 1.0);
+    }
+}
+
+
+Frustum::Frustum(const glm::mat4 &view_projection){
+
+    SetMatrix(view_projection);
+}
+
+
+Frustum::~Frustum(){
+}
+
+
+void Frustum::SetMatrix(const glm::mat4 &view_projection){
+
+    // Rows of the matrix (glm is column-major)
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; i++){
+        row[i] = glm::vec4(view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]);
+    }
+
+    // A point p is inside when -w <= x, y, z <= w in clip space
+    plane_[Left] = row[3] + row[0];
+    plane_[Right] = row[3] - row[0];
+    plane_[Bottom] = row[3] + row[1];
+    plane_[Top] = row[3] - row[1];
+    plane_[Near] = row[3] + row[2];
+    plane_[Far] = row[3] - row[2];
+
+    // Normalize, so that the plane equation gives distances
+    for (int i = 0; i < 6; i++){
+        plane_[i] /= glm::length(glm::vec3(plane_[i]));
+    }
+}
+
+
+glm::vec4 Frustum::GetPlane(FrustumPlane plane) const {
+
+    return plane_[plane];
+}
+
+
+bool Frustum::TestSphere(glm::vec3 center, float radius) const {
+
+    for (int i = 0; i < 6; i++){
+        if (glm::dot(glm::vec3(plane_[i]), center) + plane_[i].w < -radius){
+            return false;
+        }
+    }
+    return true;
+}
+
+
+Frustum::FrustumResult Frustum::TestBox(glm::vec3 min, glm::vec3 max) const {
+
+    bool intersecting = false;
+    for (int i = 0; i < 6; i++){
+        glm::vec3 normal(plane_[i]);
+
+        // Corners of the box furthest along and against the normal
+        glm::vec3 far_corner(normal.x >= 0.0 ? max.x : min.x, normal.y >= 0.0 ? max.y : min.y, normal.z >= 0.0 ? max.z : min.z);
+        glm::vec3 near_corner(normal.x >= 0.0 ? min.x : max.x, normal.y >= 0.0 ? min.y : max.y, normal.z >= 0.0 ? min.z : max.z);
+
+        if (glm::dot(normal, far_corner) + plane_[i].w < 0.0){
+            return Outside;
+        }
+        if (glm::dot(normal, near_corner) + plane_[i].w < 0.0){
+            intersecting = true;
+        }
+    }
+    return intersecting ? Intersecting : Inside;
+}
+
+
+int Frustum::TestSpheres(const float *x, const float *y, const float *z, const float *radius, int count, unsigned char *visible) const {
+
+    int num_visible = 0;
+    int i = 0;
+
+#ifdef FRUSTUM_AVX
+    // Eight spheres at a time
+    for (; i + 8 <= count; i += 8){
+        __m256 cx = _mm256_loadu_ps(x + i);
+        __m256 cy = _mm256_loadu_ps(y + i);
+        __m256 cz = _mm256_loadu_ps(z + i);
+        __m256 neg_r = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(radius + i));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; p++){
+            __m256 d = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(plane_[p].x)), _mm256_mul_ps(cy, _mm256_set1_ps(plane_[p].y))),
+                _mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(plane_[p].z)), _mm256_set1_ps(plane_[p].w)));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, neg_r, _CMP_GE_OQ));
+        }
+        int mask = _mm256_movemask_ps(inside);
+        for (int k = 0; k < 8; k++){
+            visible[i + k] = (mask >> k) & 1;
+            num_visible += visible[i + k];
+        }
+    }
+#endif
+
+#ifdef FRUSTUM_SSE
+    // Four spheres at a time
+    for (; i + 4 <= count; i += 4){
+        __m128 cx = _mm_loadu_ps(x + i);
+        __m128 cy = _mm_loadu_ps(y + i);
+        __m128 cz = _mm_loadu_ps(z + i);
+        __m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i));
+        __m128 inside = _mm_cmpeq_ps(neg_r, neg_r);
+        for (int p = 0; p < 6; p++){
+            __m128 d = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane_[p].x)), _mm_mul_ps(cy, _mm_set1_ps(plane_[p].y))),
+                _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane_[p].z)), _mm_set1_ps(plane_[p].w)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, neg_r));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int k = 0; k < 4; k++){
+            visible[i + k] = (mask >> k) & 1;
+            num_visible += visible[i + k];
+        }
+    }
+#endif
+
+    // Remaining spheres
+    for (; i < count; i++){
+        visible[i] = TestSphere(glm::vec3(x[i], y[i], z[i]), radius[i]) ? 1 : 0;
+        num_visible += visible[i];
+    }
+
+    return num_visible;
+}
+
+} // namespace game
@@ -0,0 +1,42 @@
+#ifndef FRUSTUM_H_
+#define FRUSTUM_H_
+
+#include <glm/glm.hpp>
+
+namespace game {
+
+    // Planes of a view frustum, used to cull bounding spheres
+    class Frustum {
+
+        public:
+            typedef enum Side { Left, Right, Bottom, Top, Near, Far } FrustumPlane;
+            typedef enum Result { Outside, Intersecting, Inside } FrustumResult;
+
+            Frustum(void);
+            // Extract the planes of a combined projection * view matrix
+            Frustum(const glm::mat4 &view_projection);
+            ~Frustum();
+
+            void SetMatrix(const glm::mat4 &view_projection);
+
+            // Plane as (normal, distance), with the normal pointing inside
+            glm::vec4 GetPlane(FrustumPlane plane) const;
+
+            // Test one sphere
+            bool TestSphere(glm::vec3 center, float radius) const;
+            // Classify an axis-aligned box
+            FrustumResult TestBox(glm::vec3 min, glm::vec3 max) const;
+            // Test 'count' spheres stored as separate coordinate arrays and
+            // write 1 to 'visible' for those that touch the frustum
+            // Uses 8-wide AVX and 4-wide SSE batches when available
+            // Returns the number of visible spheres
+            int TestSpheres(const float *x, const float *y, const float *z, const float *radius, int count, unsigned char *visible) const;
+
+        private:
+            glm::vec4 plane_[6];
+
+    }; // class Frustum
+
+} // namespace game
+
+#endif // FRUSTUM_H_
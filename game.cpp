@@ -1,8 +1,22 @@
 #include <iostream>
+#include <fstream>
 #include <time.h>
 #include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#ifdef USE_EGL
+// Keep the X11 headers, and their macros, out
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 #include "game.h"
+#include "clock.h"
+#include "profiler.h"
+#include "logger.h"
 #include "path_config.h"
 
 namespace game {
@@ -15,12 +29,34 @@ const std::string window_title_g = "Demo";
 const unsigned int window_width_g = 1600;
 const unsigned int window_height_g = 1200;
 const bool window_full_screen_g = false;
+// Game time per frame when rendering offscreen or walking a path
+const double fixed_time_step_g = 1.0 / 60.0;
+// Game time per simulation step, and most steps run in one frame
+const double simulation_step_g = 1.0 / 60.0;
+const int max_simulation_steps_g = 5;
+// Longest frame time the simulation catches up on
+const double max_frame_time_g = 0.25;
+// Fraction of a step the time can fall short of it and still run the
+// step, so a clock stepped at the simulation rate gives one per frame
+const double step_tolerance_g = 1e-3;
+
+// Position of the camera, printed a few times a second at most
+LogChannel camera_log_g("camera", 0.25);
+
+#ifdef USE_EGL
+// Offscreen context
+EGLDisplay egl_display_g = EGL_NO_DISPLAY;
+EGLContext egl_context_g = EGL_NO_CONTEXT;
+#endif
 
 // Viewport and camera settings
 float camera_near_clip_distance_g = 0.01;
 float camera_far_clip_distance_g = 1000.0;
 float camera_fov_g = 20.0; // Field-of-view of camera
 const glm::vec3 viewport_background_color_g(0.0, 0.0, 0.0);
+// Sky box faces and their offsets from the camera
+const std::string sky_face_name_g[] = { "front", "back", "left", "right", "top", "bottom" };
+const glm::vec3 sky_face_offset_g[] = { glm::vec3(0, 0, -1), glm::vec3(0, 0, 1), glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0) };
 glm::vec3 camera_position_g(0.5, 1, 10.0);
 glm::vec3 camera_look_at_g(0.0, camera_position_g.y, 0.0);
 glm::vec3 camera_up_g(0.0, 1.0, 0.0);
@@ -43,6 +79,55 @@ std::string block_locate = "BlockA";
 Game::Game(void){
 
     // Don't do work in the constructor, leave it for the Init() function
+    window_ = NULL;
+    headless_ = false;
+    headless_frames_ = 0;
+    headless_seconds_ = 0.0;
+    bake_static_ = true;
+    simulation_steps_ = 0;
+    frame_ = 0;
+    start_time_ = 0.0;
+    screen_buffer_ = 0;
+    screen_color_ = 0;
+    screen_depth_ = 0;
+    benchmark_ = false;
+    recorded_frame_ = -1;
+    recorded_yaw_ = 0.0;
+}
+
+
+void Game::SetHeadless(int frames, double seconds, std::string capture){
+
+    headless_ = true;
+    headless_frames_ = frames;
+    headless_seconds_ = seconds;
+    capture_file_ = capture;
+}
+
+
+void Game::SetComparison(std::string reference_file){
+
+    compare_file_ = reference_file;
+}
+
+
+void Game::SetBaking(bool bake){
+
+    bake_static_ = bake;
+}
+
+
+void Game::SetBenchmark(std::string path_file, std::string report_file){
+
+    benchmark_ = true;
+    path_file_ = path_file;
+    report_file_ = report_file;
+}
+
+
+void Game::SetRecording(std::string path_file){
+
+    record_file_ = path_file;
 }
 
 
@@ -53,6 +138,16 @@ void Game::Init(void){
     InitView();
     InitEventHandlers();
 
+    // Update the scene on all cores
+    scene_.SetJobSystem(&jobs_);
+
+    // A path is walked frame by frame, so its frames only depend on the
+    // path
+    if (benchmark_){
+        path_.Load(path_file_);
+        Clock::SetStep(fixed_time_step_g);
+    }
+
     // Set variables
     animating_ = true;
     effect = false;
@@ -62,6 +157,11 @@ void Game::Init(void){
        
 void Game::InitWindow(void){
 
+    if (headless_){
+        InitHeadless();
+        return;
+    }
+
     // Initialize the window management library (GLFW)
     if (!glfwInit()){
         throw(GameException(std::string("Could not initialize the GLFW library")));
@@ -91,6 +191,89 @@ void Game::InitWindow(void){
 }
 
 
+void Game::InitHeadless(void){
+
+#ifdef USE_EGL
+    // Context with no surface, on the surfaceless platform of Mesa when
+    // there is one, so no display server is needed
+    EGLDisplay display = EGL_NO_DISPLAY;
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (get_platform_display){
+        display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (display == EGL_NO_DISPLAY){
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)){
+        throw(GameException(std::string("Could not initialize EGL")));
+    }
+    egl_display_g = display;
+    eglBindAPI(EGL_OPENGL_API);
+
+    EGLint config_attributes[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config;
+    EGLint num_configs = 0;
+    eglChooseConfig(display, config_attributes, &config, 1, &num_configs);
+    egl_context_g = eglCreateContext(display, num_configs ? config : (EGLConfig) 0, EGL_NO_CONTEXT, NULL);
+    if (egl_context_g == EGL_NO_CONTEXT){
+        throw(GameException(std::string("Could not create an offscreen OpenGL context")));
+    }
+
+    // Without surfaceless support, a small pbuffer makes the context
+    // current; the game draws to its own frame buffer either way
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context_g)){
+        EGLint pbuffer_attributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        EGLSurface surface = num_configs ? eglCreatePbufferSurface(display, config, pbuffer_attributes) : EGL_NO_SURFACE;
+        if (surface == EGL_NO_SURFACE || !eglMakeCurrent(display, surface, surface, egl_context_g)){
+            throw(GameException(std::string("Could not make the offscreen OpenGL context current")));
+        }
+    }
+
+    // GLEW would look for the window system it was built for; only the
+    // OpenGL entry points are needed
+    glewExperimental = GL_TRUE;
+    GLenum err = glewContextInit();
+#else
+    // Without EGL, the context comes from a window that is never shown
+    if (!glfwInit()){
+        throw(GameException(std::string("Could not initialize the GLFW library")));
+    }
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    window_ = glfwCreateWindow(window_width_g, window_height_g, window_title_g.c_str(), NULL, NULL);
+    if (!window_){
+        glfwTerminate();
+        throw(GameException(std::string("Could not create window")));
+    }
+    glfwMakeContextCurrent(window_);
+
+    glewExperimental = GL_TRUE;
+    GLenum err = glewInit();
+#endif
+    if (err != GLEW_OK){
+        throw(GameException(std::string("Could not initialize the GLEW library: ")+std::string((const char *) glewGetErrorString(err))));
+    }
+
+    // Frame buffer the size of the window
+    glGenFramebuffers(1, &screen_buffer_);
+    glBindFramebuffer(GL_FRAMEBUFFER, screen_buffer_);
+    glGenRenderbuffers(1, &screen_color_);
+    glBindRenderbuffer(GL_RENDERBUFFER, screen_color_);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, window_width_g, window_height_g);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, screen_color_);
+    glGenRenderbuffers(1, &screen_depth_);
+    glBindRenderbuffer(GL_RENDERBUFFER, screen_depth_);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, window_width_g, window_height_g);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, screen_depth_);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
+        throw(GameException(std::string("Could not set up the offscreen frame buffer")));
+    }
+    scene_.SetScreenFramebuffer(screen_buffer_);
+
+    // Same frames on every run, whatever the speed of the machine
+    Clock::SetStep(fixed_time_step_g);
+}
+
+
 void Game::InitView(void){
 
     // Set up z-buffer
@@ -99,7 +282,12 @@ void Game::InitView(void){
 
     // Set viewport
     int width, height;
-    glfwGetFramebufferSize(window_, &width, &height);
+    if (headless_){
+        width = window_width_g;
+        height = window_height_g;
+    } else {
+        glfwGetFramebufferSize(window_, &width, &height);
+    }
     glViewport(0, 0, width, height);
 
     // Set up camera
@@ -112,6 +300,11 @@ void Game::InitView(void){
 
 void Game::InitEventHandlers(void){
 
+    // No input without a window
+    if (headless_){
+        return;
+    }
+
     // Set event callbacks
     glfwSetKeyCallback(window_, KeyCallback);
     glfwSetFramebufferSizeCallback(window_, ResizeCallback);
@@ -123,6 +316,8 @@ void Game::InitEventHandlers(void){
 
 void Game::SetupResources(void){
 
+    ProfileZone zone("Game::SetupResources");
+
     // Load material to be applied to torus
     std::string filename = std::string(MATERIAL_DIRECTORY) + std::string("/three-term_shiny_blue");
     resman_.LoadResource(Material, "ShinyBlueMaterial", filename.c_str());
@@ -136,6 +331,13 @@ void Game::SetupResources(void){
     resman_.LoadResource(Material, "Self", filename.c_str());
     filename = std::string(MATERIAL_DIRECTORY) + std::string("/lit");
     resman_.LoadResource(Material, "Light", filename.c_str());
+    // These light in world or view space, or not at all, so they look the
+    // same on merged geometry
+    resman_.GetResource("ShinyBlueMaterial")->SetMergeable(true);
+    resman_.GetResource("Material")->SetMergeable(true);
+    resman_.GetResource("TextureMaterial")->SetMergeable(true);
+    resman_.GetResource("Normal")->SetMergeable(true);
+    resman_.GetResource("Self")->SetMergeable(true);
 
     // Load material for screen-space effect
     filename = std::string(MATERIAL_DIRECTORY) + std::string("/screen_space_magic");
@@ -149,6 +351,12 @@ void Game::SetupResources(void){
     filename = std::string(MATERIAL_DIRECTORY) + std::string("/fire");
     resman_.LoadResource(Material, "FireMaterial", filename.c_str());
 
+    // Load compute program for culling on the GPU
+    if (GLEW_VERSION_4_3){
+        filename = std::string(MATERIAL_DIRECTORY) + std::string("/cull");
+        resman_.LoadComputeProgram("CullMaterial", filename.c_str());
+    }
+
     //Load texture
     filename = std::string(TEXTURE_DIRECTORY) + std::string("/skybox/front.jpg");
     resman_.LoadResource(Texture, "FrontTexture", filename.c_str());
@@ -233,6 +441,8 @@ void Game::SetupResources(void){
 
 void Game::SetupScene(void) {
 
+    ProfileZone zone("Game::SetupScene");
+
     // Set background color for the scene
     scene_.SetBackgroundColor(viewport_background_color_g);
 
@@ -252,6 +462,7 @@ void Game::SetupScene(void) {
     floor->SetPosition(glm::vec3(0, -2, 0));
     floor->Scale(glm::vec3(80, 80, 80));
     floor->SetPlayer(player);
+    floor->SetStatic(true);
 
     game::SceneNode* floor2 = CreateInstance<SceneNode>("floor2", "wall", "Material", "Rock");
     floor2->Rotate(rotation);
@@ -259,6 +470,7 @@ void Game::SetupScene(void) {
     floor2->SetPosition(glm::vec3(170, -2, 90));
     floor2->Scale(glm::vec3(80, 80, 80));
     floor2->SetPlayer(player);
+    floor2->SetStatic(true);
 
     game::SceneNode* floor3 = CreateInstance<SceneNode>("floor3", "wall", "Material", "Rock");
     floor3->Rotate(glm::angleAxis(-glm::pi<float>() / 2 - glm::pi<float>() / 18, glm::vec3(1.0, 0.0, 0.0)));
@@ -266,10 +478,12 @@ void Game::SetupScene(void) {
     floor3->SetPosition(glm::vec3(170, -18, -68));
     floor3->Scale(glm::vec3(80, 80, 80));
     floor3->SetPlayer(player);
+    floor3->SetStatic(true);
 
     game::SceneNode* floor4 = CreateInstance<SceneNode>("step", "wall", "Material", "Rock");
     floor4->SetPosition(glm::vec3(130, -12, 10));
     floor4->Scale(glm::vec3(10, 10, 10));
+    floor4->SetStatic(true);
 
     CreateSkyBox();
 
@@ -298,125 +512,441 @@ void Game::SetupScene(void) {
     magicC->SetPosition(glm::vec3(130, -10.5, -35));
     magicC->SetPlayer(player);
 
+    // Interaction volumes of the magic circles
+    triggers_.AddTrigger(magicA->GetName(), magicA->GetPosition(), 15);
+    triggers_.AddTrigger(magicB->GetName(), magicB->GetPosition(), 15);
+    triggers_.AddTrigger(magicC->GetName(), magicC->GetPosition(), 15);
+
+    // Merge the level pieces that never move, to draw them in a few calls
+    if (bake_static_){
+        scene_.BakeStatic(&resman_);
+    }
+
+    ResolveNodeHandles();
+}
+
+
+void Game::ResolveNodeHandles(void){
+
+    cover_node_ = scene_.GetHandle("cover");
+    fire_node_ = scene_.GetHandle("Fire");
+    door_node_ = scene_.GetHandle("Door");
+    floor_node_[0] = scene_.GetHandle("floor");
+    floor_node_[1] = scene_.GetHandle("floor2");
+    floor_node_[2] = scene_.GetHandle("floor3");
+    magic_node_[0] = scene_.GetHandle("magicA");
+    magic_node_[1] = scene_.GetHandle("magicB");
+    for (int i = 0; i < NumSkyFaces; i++){
+        sky_node_[i] = scene_.GetHandle(sky_face_name_g[i]);
+    }
+}
+
+void Game::UpdateTriggers(void){
+
+    const std::vector<TriggerEvent> &events = triggers_.Update(player->GetPosition());
+
+    // Leaving the trigger the player interacts with ends the interaction
+    for (int i = 0; i < events.size(); i++){
+        if (!events[i].enter && player->GetInteraction() == triggers_.GetTriggerName(events[i].trigger)){
+            player->SetInteraction("Nothing");
+        }
+    }
+    // Entering a trigger starts an interaction if there is none
+    for (int i = 0; i < events.size(); i++){
+        if (events[i].enter && player->GetInteraction() == "Nothing"){
+            player->SetInteraction(triggers_.GetTriggerName(events[i].trigger));
+        }
+    }
+    // Fall back to another trigger the player is still in
+    const std::vector<int> &inside = triggers_.GetInside();
+    if (player->GetInteraction() == "Nothing" && inside.size() > 0){
+        player->SetInteraction(triggers_.GetTriggerName(inside[0]));
+    }
 }
 
+
 void Game::MainLoop(void){
     ChangetoCastle();
-    scene_.GetNode("cover")->SetPosition(glm::vec3(player->GetPosition().x, camera_.GetPosition().y, player->GetPosition().z) + glm::vec3(-0.2, 0, -4));
+    scene_.GetNode(cover_node_)->SetPosition(glm::vec3(player->GetPosition().x, camera_.GetPosition().y, player->GetPosition().z) + glm::vec3(-0.2, 0, -4));
     
 
     // Loop while the user did not close the window
-    while (!glfwWindowShouldClose(window_)){
+    start_time_ = Clock::GetWallTime();
+    // Simulation time not stepped yet; the first frame runs a step
+    double last_time = Clock::GetTime();
+    double lag = simulation_step_g;
+    simulation_steps_ = 0;
+    simulation_.Start([this](){
+        for (int i = 0; i < simulation_steps_; i++){
+            Simulate();
+        }
+    });
+    while (KeepRunning()){
+        ProfileZone frame_zone("Frame");
+        double frame_start = Clock::GetWallTime();
+        ApplyInput();
+        if (benchmark_){
+            PlayPath();
+        }
         camera_.SetPosition(glm::vec3(player->GetPosition().x, player->GetPosition().y + 11, player->GetPosition().z));
-        // Animate the scene
-        if (animating_){
-            static double last_time = 0;
-            double current_time = glfwGetTime();
-            if ((current_time - last_time) > 0.01){
-                if (game_start && !win) {
-                    scene_.GetNode("cover")->SetPosition(scene_.GetNode("cover")->GetPosition() + glm::vec3(0, -0.2, 0));
-                }
 
-                std::cout << "(" << camera_.GetPosition().x << ", " << camera_.GetPosition().z << ")" << "\n";
+        // The nodes are as the steps of the last frame left them; the time
+        // left over after those steps places the frame between the last
+        // two of them
+        float alpha = glm::clamp((float) (lag / simulation_step_g), 0.0f, 1.0f);
+
+        // Fixed steps of simulation up to the current time; after a long
+        // frame only a few steps are run, and the time left behind is
+        // dropped rather than caught up later
+        double current_time = Clock::GetTime();
+        lag += std::min(current_time - last_time, max_frame_time_g);
+        last_time = current_time;
+        int steps = 0;
+        while (lag > simulation_step_g * (1.0 - step_tolerance_g) && steps < max_simulation_steps_g){
+            lag -= simulation_step_g;
+            steps++;
+        }
+        if (steps == max_simulation_steps_g){
+            lag = std::min(lag, simulation_step_g);
+        }
 
-                // door animation
-                if (door_open) {
-                    SceneNode* door = scene_.GetNode("Door");
-                    if (door->GetPosition().y > -20) {
-                        door->Translate(glm::vec3(0, -2, 0));
-                    }
-                }
+        //scene_.GetNode("ParticleInstance")->SetPosition(glm::vec3(0, 0, -0.5));
+        for (int i = 0; i < NumSkyFaces; i++){
+            scene_.GetNode(sky_node_[i])->SetPosition(camera_.GetPosition() + sky_face_offset_g[i]);
+        }
+        // Record the frame from the nodes between the last two steps; the
+        // effect is chosen with it
+        bool flame = effect;
+        bool magic = effect2;
+        {
+            ProfileZone zone("Prepare");
+            scene_.Interpolate(alpha);
+            // Last chance for input to turn the view of this frame
+            LatchCamera();
+            scene_.Prepare(&camera_, &light_);
+            scene_.EndInterpolation();
+        }
+        // The pose the player was drawn with, before the steps move on
+        if (!record_file_.empty()){
+            RecordPath();
+        }
 
-                // terrain hieght algorithm
-                SceneNode* reference_floor;
-                if (block_locate == "BlockA") {
-                    reference_floor = scene_.GetNode("floor");
+        // The steps run on the simulation thread while this thread draws
+        // the recorded frame; they show up in the next one. Nothing else
+        // touches the nodes until they are done
+        simulation_steps_ = steps;
+        simulation_.Run();
 
-                }else if(block_locate == "BlockB") {
-                    reference_floor = scene_.GetNode("floor2");
+        // Draw the scene
+        {
+            ProfileZone zone("Render");
+            // Draw the scene to a texture
+            if (flame) {
+                scene_.DrawToTexture();
+                scene_.DisplayTexture(resman_.GetResource("FlameEffect")->GetResource());
+            }else if (magic) {
+                scene_.DrawToTexture();
+                scene_.DisplayTexture(resman_.GetResource("MagicEffect")->GetResource());
+            }
+            else {
+                scene_.Draw();
+            }
+        }
 
-                }
-                else if (block_locate == "BlockC") {
-                    reference_floor = scene_.GetNode("floor3");
 
-                }
-                float y = reference_floor->GetHight() - 10;
-                player->SetPosition(glm::vec3(player->GetPosition().x, y, player->GetPosition().z));
-                // fire distance
-                SceneNode* fire = scene_.GetNode("Fire");
-                float distance = glm::distance(glm::vec2(fire->GetPosition().x, fire->GetPosition().z), glm::vec2(player->GetPosition().x, player->GetPosition().z));
-                if (distance < 10) {
-                    effect = true;
-                }
-                else {
-                    effect = false;
-                }
 
-                // magic distance
-                SceneNode* magic;
-                if (block_locate == "BlockA") {
 
-                    magic = scene_.GetNode("magicA");
+        {
+            ProfileZone zone("Present");
+            if (headless_){
+                // Nothing to show; send the frame to the GPU
+                glFlush();
+            } else {
+                // Push buffer drawn in the background onto the display
+                glfwSwapBuffers(window_);
+            }
+            input_.Presented();
+        }
+        {
+            ProfileZone zone("Wait");
+            simulation_.Wait();
+        }
+        if (!headless_){
+            // Update other events like input handling
+            glfwPollEvents();
+        }
+        if (benchmark_){
+            // The frame time covers the rendering
+            glFinish();
+            results_.AddFrame(Clock::GetWallTime() - frame_start, scene_.GetDrawStats());
+        }
+        frame_++;
+        Clock::Tick();
+        Profiler::EndFrame();
+    }
+    simulation_.Stop();
 
-                }
-                else if (block_locate == "BlockB") {
+    if (headless_){
+        FinishHeadless();
+    }
+    if (benchmark_){
+        if (report_file_.empty()){
+            Logger::Flush();
+            results_.WriteReport(std::cout, path_file_);
+        } else {
+            std::ofstream f(report_file_.c_str());
+            if (f.fail()){
+                throw(GameException(std::string("Error opening file ")+report_file_));
+            }
+            results_.WriteReport(f, path_file_);
+        }
+    }
+    if (!record_file_.empty()){
+        path_.Save(record_file_);
+    }
+}
 
-                    magic = scene_.GetNode("magicB");
 
-                }
-                if (block_locate != "BlockC") {
-                    distance = glm::distance(glm::vec2(magic->GetPosition().x, magic->GetPosition().z), glm::vec2(player->GetPosition().x, player->GetPosition().z));
-                    if (distance < 10) {
-                        effect2 = true;
-                    }
-                    else {
-                        effect2 = false;
-                    }
-                }
+bool Game::KeepRunning(void){
+
+    if (benchmark_ && frame_ >= path_.GetLength()){
+        return false;
+    }
+    if (benchmark_ && headless_){
+        return true;
+    }
+    if (!headless_){
+        return !glfwWindowShouldClose(window_);
+    }
+    if (headless_frames_ > 0){
+        return frame_ < headless_frames_;
+    }
+    return Clock::GetWallTime() - start_time_ < headless_seconds_;
+}
+
+
+void Game::FinishHeadless(void){
+
+    // Wait for the last frame, so the time covers all the rendering
+    glFinish();
+    double seconds = Clock::GetWallTime() - start_time_;
+    Logger::Write(InfoLevel, "frames %d, seconds %g, ms per frame %g", frame_, seconds, frame_ > 0 ? seconds * 1000.0 / frame_ : 0.0);
+
+    if (!capture_file_.empty()){
+        SaveScreen(capture_file_);
+    }
+    if (!compare_file_.empty()){
+        CompareScreen(compare_file_);
+    }
+}
+
+
+void Game::ReadScreen(std::vector<unsigned char> &data){
+
+    std::vector<unsigned char> pixels(window_width_g * window_height_g * 3);
+    glBindFramebuffer(GL_FRAMEBUFFER, screen_buffer_);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, window_width_g, window_height_g, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+
+    // OpenGL rows go bottom to top
+    data.resize(pixels.size());
+    int row = window_width_g * 3;
+    for (int i = 0; i < window_height_g; i++){
+        std::copy(pixels.begin() + (window_height_g - 1 - i) * row, pixels.begin() + (window_height_g - i) * row, data.begin() + i * row);
+    }
+}
+
 
+void Game::SaveScreen(std::string filename){
 
-                last_time = current_time;
+    std::vector<unsigned char> data;
+    ReadScreen(data);
+
+    std::ofstream f(filename.c_str(), std::ios::binary);
+    if (f.fail()){
+        throw(GameException(std::string("Error opening file ")+filename));
+    }
+    f << "P6\n" << window_width_g << " " << window_height_g << "\n255\n";
+    f.write((const char *) &data[0], data.size());
+    f.close();
+}
+
+
+void Game::CompareScreen(std::string filename){
+
+    std::ifstream f(filename.c_str(), std::ios::binary);
+    if (f.fail()){
+        throw(GameException(std::string("Error opening file ")+filename));
+    }
+    std::string format;
+    int width, height, max_value;
+    f >> format >> width >> height >> max_value;
+    f.get();
+    if (format != "P6" || width != window_width_g || height != window_height_g || max_value != 255){
+        throw(GameException(filename+std::string(" is not a capture of the same size")));
+    }
+    std::vector<unsigned char> reference(width * height * 3);
+    f.read((char *) &reference[0], reference.size());
+    if (f.fail()){
+        throw(GameException(std::string("Error reading file ")+filename));
+    }
+
+    std::vector<unsigned char> data;
+    ReadScreen(data);
+    int largest = 0;
+    int differing = 0;
+    for (int i = 0; i < width * height; i++){
+        int difference = 0;
+        for (int j = 0; j < 3; j++){
+            difference = std::max(difference, std::abs(data[i * 3 + j] - reference[i * 3 + j]));
+        }
+        largest = std::max(largest, difference);
+        differing += (difference > 0);
+    }
+    Logger::Write(InfoLevel, "compared with %s: largest difference %d/255, differing pixels %.2f%%", filename.c_str(), largest, differing * 100.0 / (width * height));
+}
+
+
+
+void Game::Simulate(void){
+
+    scene_.BeginStep();
+    // Animate the scene
+    if (animating_){
+        ProfileZone zone("Animate");
+        if (game_start && !win) {
+            SceneNode* cover = scene_.GetNode(cover_node_);
+            cover->SetPosition(cover->GetPosition() + glm::vec3(0, -0.2, 0));
+        }
+
+        camera_log_g.Write(InfoLevel, "(%g, %g)", camera_.GetPosition().x, camera_.GetPosition().z);
+
+        // door animation
+        if (door_open) {
+            SceneNode* door = scene_.GetNode(door_node_);
+            if (door->GetPosition().y > -20) {
+                door->Translate(glm::vec3(0, -2, 0));
             }
         }
-        //scene_.GetNode("ParticleInstance")->SetPosition(glm::vec3(0, 0, -0.5));
-        SceneNode* sky_box = scene_.GetNode("front");
-        sky_box->SetPosition(camera_.GetPosition()+glm::vec3(0,0,-1));
-        sky_box = scene_.GetNode("back");
-        sky_box->SetPosition(camera_.GetPosition() + glm::vec3(0, 0, 1));
-        sky_box = scene_.GetNode("left");
-        sky_box->SetPosition(camera_.GetPosition() + glm::vec3(1, 0, 0));
-        sky_box = scene_.GetNode("right");
-        sky_box->SetPosition(camera_.GetPosition() + glm::vec3(-1, 0, 0));
-        sky_box = scene_.GetNode("top");
-        sky_box->SetPosition(camera_.GetPosition() + glm::vec3(0, 1, 0));
-        sky_box = scene_.GetNode("bottom");
-        sky_box->SetPosition(camera_.GetPosition() + glm::vec3(0, -1, 0));
-        // Draw the scene
-        scene_.Update();
-        // Draw the scene to a texture
-        if (effect) {
-            scene_.DrawToTexture(&camera_,&light_);
-            scene_.DisplayTexture(resman_.GetResource("FlameEffect")->GetResource());
-        }else if (effect2) {
-            scene_.DrawToTexture(&camera_, &light_);
-            scene_.DisplayTexture(resman_.GetResource("MagicEffect")->GetResource());
+
+        // terrain hieght algorithm
+        SceneNode* reference_floor;
+        if (block_locate == "BlockA") {
+            reference_floor = scene_.GetNode(floor_node_[0]);
+
+        }else if(block_locate == "BlockB") {
+            reference_floor = scene_.GetNode(floor_node_[1]);
+
+        }
+        else if (block_locate == "BlockC") {
+            reference_floor = scene_.GetNode(floor_node_[2]);
+
+        }
+        float y = reference_floor->GetHight() - 10;
+        player->SetPosition(glm::vec3(player->GetPosition().x, y, player->GetPosition().z));
+        // fire distance
+        SceneNode* fire = scene_.GetNode(fire_node_);
+        float distance = glm::distance(glm::vec2(fire->GetPosition().x, fire->GetPosition().z), glm::vec2(player->GetPosition().x, player->GetPosition().z));
+        if (distance < 10) {
+            effect = true;
         }
         else {
-            scene_.Draw(&camera_,&light_);
+            effect = false;
         }
 
+        // magic distance
+        SceneNode* magic;
+        if (block_locate == "BlockA") {
+
+            magic = scene_.GetNode(magic_node_[0]);
+
+        }
+        else if (block_locate == "BlockB") {
+
+            magic = scene_.GetNode(magic_node_[1]);
+
+        }
+        if (block_locate != "BlockC") {
+            distance = glm::distance(glm::vec2(magic->GetPosition().x, magic->GetPosition().z), glm::vec2(player->GetPosition().x, player->GetPosition().z));
+            if (distance < 10) {
+                effect2 = true;
+            }
+            else {
+                effect2 = false;
+            }
+        }
+    }
+    // Update the scene
+    {
+        ProfileZone zone("Update");
+        UpdateTriggers();
+        scene_.Update();
+    }
+    scene_.EndStep();
+}
 
 
+void Game::PlayPath(void){
 
-        // Push buffer drawn in the background onto the display
-        glfwSwapBuffers(window_);
+    // The height comes from the floor, as when walking
+    glm::vec2 position;
+    float yaw;
+    if (path_.GetPose(frame_, position, yaw)){
+        player->SetPosition(glm::vec3(position.x, player->GetPosition().y, position.y));
+        // The camera turns with the player, as with the arrow keys
+        camera_.Yaw(yaw - player->GetAngle());
+        player->SetAngle(yaw);
+    }
 
-        // Update other events like input handling
-        glfwPollEvents();
+    path_.GetEvents(frame_, path_events_);
+    for (int i = 0; i < path_events_.size(); i++){
+        const PathEvent &event = path_events_[i];
+        if (event.type == KeyPathEvent){
+            ProcessKey(this, event.key, GLFW_PRESS);
+        } else if (event.type == ZonePathEvent){
+            if (event.name == "castle"){
+                ChangetoCastle();
+            } else if (event.name == "village"){
+                ChangetoVillage();
+            } else {
+                throw(GameException(std::string("Unknown zone ")+event.name));
+            }
+        } else {
+            block_locate = event.name;
+        }
     }
 }
 
 
+void Game::RecordPath(void){
+
+    // Input is applied at the start of the frame, as PlayPath replays it
+    int frame = frame_;
+    glm::vec2 position(player->GetPosition().x, player->GetPosition().z);
+    float yaw = player->GetAngle();
+    if (recorded_frame_ < 0 || position != recorded_position_ || yaw != recorded_yaw_){
+        // Hold the last pose until the player moved, rather than drift
+        // towards the new one
+        if (recorded_frame_ >= 0 && recorded_frame_ < frame - 1){
+            path_.AddPose(frame - 1, recorded_position_, recorded_yaw_);
+        }
+        path_.AddPose(frame, position, yaw);
+        recorded_frame_ = frame;
+        recorded_position_ = position;
+        recorded_yaw_ = yaw;
+    }
+
+    if (block_locate != recorded_block_){
+        PathEvent event;
+        event.frame = frame;
+        event.type = BlockPathEvent;
+        event.key = 0;
+        event.name = block_locate;
+        path_.AddEvent(event);
+        recorded_block_ = block_locate;
+    }
+}
+
 
 void Game::KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods){
 
@@ -424,9 +954,86 @@ void Game::KeyCallback(GLFWwindow* window, int key, int scancode, int action, in
     void* ptr = glfwGetWindowUserPointer(window);
     Game *game = (Game *) ptr;
 
+    // Applied by the main loop
+    game->input_.Push(key, action);
+}
+
+
+void Game::ApplyInput(void){
+
+    input_.Take(input_events_);
+    for (int i = 0; i < input_events_.size(); i++){
+        int key = input_events_[i].key;
+        int action = input_events_[i].action;
+
+        // Keys other than walking and turning go into the recorded path;
+        // the walk is recorded as poses
+        if (!record_file_.empty() && action == GLFW_PRESS &&
+            key != GLFW_KEY_W && key != GLFW_KEY_A && key != GLFW_KEY_S && key != GLFW_KEY_D &&
+            key != GLFW_KEY_LEFT && key != GLFW_KEY_RIGHT && key != GLFW_KEY_UP && key != GLFW_KEY_DOWN &&
+            key != GLFW_KEY_Q){
+            PathEvent event;
+            event.frame = frame_;
+            event.type = KeyPathEvent;
+            event.key = key;
+            path_.AddEvent(event);
+        }
+
+        ProcessKey(this, key, action);
+    }
+}
+
+
+void Game::LatchCamera(void){
+
+    if (headless_){
+        return;
+    }
+
+    // Turns only change the camera and the heading of the player, which
+    // nothing reads until the next frame; other events wait for it, and
+    // so do the turns queued after them, to keep their order
+    static const int turn_keys[] = { GLFW_KEY_UP, GLFW_KEY_DOWN, GLFW_KEY_LEFT, GLFW_KEY_RIGHT };
+    glfwPollEvents();
+    input_.TakeLeading(turn_keys, 4, input_events_);
+    for (int i = 0; i < input_events_.size(); i++){
+        ProcessKey(this, input_events_[i].key, input_events_[i].action);
+    }
+}
+
+
+void Game::ProcessKey(Game *game, int key, int action){
+
     // Quit game if 'q' is pressed
-    if (key == GLFW_KEY_Q && action == GLFW_PRESS){
-        glfwSetWindowShouldClose(window, true);
+    if (key == GLFW_KEY_Q && action == GLFW_PRESS && game->window_){
+        glfwSetWindowShouldClose(game->window_, true);
+    }
+
+    // Print culling and draw statistics of the last frame if 'p' is pressed
+    if (key == GLFW_KEY_P && action == GLFW_PRESS){
+        const DrawStats &stats = game->scene_.GetDrawStats();
+        Logger::Write(InfoLevel, "visible %d, culled %d, draws %d, programs %d, textures %d, buffers %d, instanced %d, indirect %d, stalls %d, lists %d", stats.visible, stats.culled, stats.draws, stats.programs, stats.textures, stats.buffers, stats.instanced, stats.indirect, stats.stalls, stats.lists);
+        LatencyStats latency = game->input_.GetLatency();
+        Logger::Write(InfoLevel, "input to swap: events %d, mean %.2f ms, p50 %.2f ms, p95 %.2f ms, max %.2f ms", latency.events, latency.mean, latency.p50, latency.p95, latency.max);
+    }
+
+    // Print the frame time percentiles of the profiled zones if 't' is
+    // pressed
+    if (key == GLFW_KEY_T && action == GLFW_PRESS){
+        if (Profiler::IsEnabled()){
+            Profiler::PrintSummary();
+        } else {
+            Logger::Write(InfoLevel, "profiler disabled, run with --profile FILE");
+        }
+    }
+
+    // Switch between culling and drawing the opaque nodes on the GPU and
+    // on the CPU if 'g' is pressed; needs OpenGL 4.3
+    if (key == GLFW_KEY_G && action == GLFW_PRESS){
+        Resource *cull = game->resman_.GetResource("CullMaterial");
+        if (cull){
+            game->scene_.SetCullProgram(game->scene_.GetCullProgram() ? 0 : cull->GetResource());
+        }
     }
     if (game_start && !win) {
 
@@ -598,8 +1205,9 @@ void Game::KeyCallback(GLFWwindow* window, int key, int scancode, int action, in
     }
     else {
         if (win) {
-            game->scene_.GetNode("cover")->SetTexture(game->resman_.GetResource("Cover2"));
-            game->scene_.GetNode("cover")->SetPosition(glm::vec3(player->GetPosition().x, game->camera_.GetPosition().y, player->GetPosition().z) + glm::vec3(-0.2, 0, -4));
+            SceneNode* cover = game->scene_.GetNode(game->cover_node_);
+            cover->SetTexture(game->resman_.GetResource("Cover2"));
+            cover->SetPosition(glm::vec3(player->GetPosition().x, game->camera_.GetPosition().y, player->GetPosition().z) + glm::vec3(-0.2, 0, -4));
 
         }
         else {
@@ -649,7 +1257,7 @@ void Game::CheckCode(Game* game, std::string name) {
                 }
                 br->SetTexture(game->resman_.GetResource("Stone"));
             }
-            std::cout << "root2" << "\n";
+            Logger::Write(InfoLevel, "root2");
         }else if (name == "root3" && code == 2) {
             code = 3;
             tree->SetTexture(game->resman_.GetResource("Stone"));
@@ -662,7 +1270,7 @@ void Game::CheckCode(Game* game, std::string name) {
                 }
                 br->SetTexture(game->resman_.GetResource("Stone"));
             }
-            std::cout << "root3" << "\n";
+            Logger::Write(InfoLevel, "root3");
             CreateBox(0, -1, 0);
             
         }
@@ -679,26 +1287,27 @@ void Game::CheckCode(Game* game, std::string name) {
 void Game::ChangetoCastle() {
     block_locate = "BlockB";
     player->SetPosition(glm::vec3(115, 0, 80));
-    light_.SetPosition(glm::vec3(scene_.GetNode("Fire")->GetPosition().x, scene_.GetNode("Fire")->GetPosition().y + 1, scene_.GetNode("Fire")->GetPosition().z));
+    glm::vec3 fire_position = scene_.GetNode(fire_node_)->GetPosition();
+    light_.SetPosition(glm::vec3(fire_position.x, fire_position.y + 1, fire_position.z));
     light_.SetColor(glm::vec3(1, 1, 0.8));
-    scene_.GetNode("front")->SetTexture(resman_.GetResource("BackTexture2"));
-    scene_.GetNode("back")->SetTexture(resman_.GetResource("FrontTexture2"));
-    scene_.GetNode("left")->SetTexture(resman_.GetResource("LeftTexture2"));
-    scene_.GetNode("right")->SetTexture(resman_.GetResource("RightTexture2"));
-    scene_.GetNode("top")->SetTexture(resman_.GetResource("TopTexture2"));
-    scene_.GetNode("bottom")->SetTexture(resman_.GetResource("BottomTexture2"));
+    scene_.GetNode(sky_node_[SkyFront])->SetTexture(resman_.GetResource("BackTexture2"));
+    scene_.GetNode(sky_node_[SkyBack])->SetTexture(resman_.GetResource("FrontTexture2"));
+    scene_.GetNode(sky_node_[SkyLeft])->SetTexture(resman_.GetResource("LeftTexture2"));
+    scene_.GetNode(sky_node_[SkyRight])->SetTexture(resman_.GetResource("RightTexture2"));
+    scene_.GetNode(sky_node_[SkyTop])->SetTexture(resman_.GetResource("TopTexture2"));
+    scene_.GetNode(sky_node_[SkyBottom])->SetTexture(resman_.GetResource("BottomTexture2"));
 }
 void Game::ChangetoVillage() {
     block_locate = "BlockA";
     player->SetPosition(glm::vec3(0, 0, 0));
     light_.SetPosition(glm::vec3(0, 5, 0));
     light_.SetColor(glm::vec3(1, 1, 1));
-    scene_.GetNode("front")->SetTexture(resman_.GetResource("FrontTexture"));
-    scene_.GetNode("back")->SetTexture(resman_.GetResource("BackTexture"));
-    scene_.GetNode("left")->SetTexture(resman_.GetResource("LeftTexture"));
-    scene_.GetNode("right")->SetTexture(resman_.GetResource("RightTexture"));
-    scene_.GetNode("top")->SetTexture(resman_.GetResource("TopTexture"));
-    scene_.GetNode("bottom")->SetTexture(resman_.GetResource("BottomTexture"));
+    scene_.GetNode(sky_node_[SkyFront])->SetTexture(resman_.GetResource("FrontTexture"));
+    scene_.GetNode(sky_node_[SkyBack])->SetTexture(resman_.GetResource("BackTexture"));
+    scene_.GetNode(sky_node_[SkyLeft])->SetTexture(resman_.GetResource("LeftTexture"));
+    scene_.GetNode(sky_node_[SkyRight])->SetTexture(resman_.GetResource("RightTexture"));
+    scene_.GetNode(sky_node_[SkyTop])->SetTexture(resman_.GetResource("TopTexture"));
+    scene_.GetNode(sky_node_[SkyBottom])->SetTexture(resman_.GetResource("BottomTexture"));
 }
 
 
@@ -712,6 +1321,15 @@ void Game::ResizeCallback(GLFWwindow* window, int width, int height){
 }
 Game::~Game(){
     
+#ifdef USE_EGL
+    if (egl_display_g != EGL_NO_DISPLAY){
+        eglMakeCurrent(egl_display_g, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (egl_context_g != EGL_NO_CONTEXT){
+            eglDestroyContext(egl_display_g, egl_context_g);
+        }
+        eglTerminate(egl_display_g);
+    }
+#endif
     glfwTerminate();
 }
 void Game::CreateBox(float x, float y, float z) {
@@ -740,8 +1358,11 @@ void Game::CreateBox(float x, float y, float z) {
     top->Rotate(rotation);
     top->SetPosition(glm::vec3(x, y + 0.5, z));
     top->SetScale(glm::vec3(1, 1, 0.5));
+    // The lid opens around its edge
+    top->SetPivot(glm::vec3(-1, 0, 0));
     top->SetPlayer(player);
     top->SetOpen(false);
+    triggers_.AddTrigger(top->GetName(), top->GetPosition(), 10);
 
     game::Box* bottom = CreateInstance<Box>("boxbottom", "wall", "TextureMaterial", "Box");
     rotation = glm::angleAxis(3 * glm::pi<float>() / 2, glm::vec3(1.0, 0.0, 0.0));
@@ -920,6 +1541,12 @@ void Game::Createbonfire(std::string name, float x, float y, float z) {
     c6->SetPosition(glm::vec3(x, y, z+0.4));
     rotation = glm::angleAxis(glm::pi<float>() / -4, glm::vec3(1.0, 0.0, 0.0));
     c6->Rotate(rotation);
+    c1->SetStatic(true);
+    c2->SetStatic(true);
+    c3->SetStatic(true);
+    c4->SetStatic(true);
+    c5->SetStatic(true);
+    c6->SetStatic(true);
     game::SceneNode* particles = CreateInstance<SceneNode>("Fire", "FireParticles", "FireMaterial", "Flame");
     particles->SetPosition(glm::vec3(x, y, z));
 }
@@ -1025,6 +1652,11 @@ void Game::CreateTreeField(int num_branches) {
     root3->SetPosition(glm::vec3(-20, 0, 20));
     root3->SetWind(glm::vec3(1, 0, 1));
     root3->SetPlayer(player);
+
+    // Interaction volumes of the trees
+    triggers_.AddTrigger(root1->GetName(), root1->GetPosition(), 10);
+    triggers_.AddTrigger(root2->GetName(), root2->GetPosition(), 10);
+    triggers_.AddTrigger(root3->GetName(), root3->GetPosition(), 10);
     // create branches
     
     //set the vator of wind
@@ -1070,6 +1702,7 @@ void Game::CreateBlockA() {
         wall->Rotate(glm::angleAxis((float)wall_angle[i], glm::vec3(0.0, 1.0, 0.0)));
         wall->SetPosition(glm::vec3(wall_coordinate[i][0], 0, wall_coordinate[i][1]));
         wall->Scale(glm::vec3(10, 10, 10));
+        wall->SetStatic(true);
         wall_arr.push_back(wall);
     }
 }
@@ -1110,6 +1743,10 @@ void Game::CreateBlockB() {
         if (wall->GetName() == "Door") {
             wall->SetPosition(glm::vec3(wall_coordinate[i][0], 0, wall_coordinate[i][1]));
             wall->SetPlayer(player);
+            triggers_.AddTrigger(wall->GetName(), wall->GetPosition(), 15);
+        }
+        else {
+            wall->SetStatic(true);
         }
         wall_arr.push_back(wall);
     }
@@ -1124,6 +1761,7 @@ void Game::CreateBlockB() {
         wall->Rotate(glm::angleAxis((float)wall_angle_complement[i], glm::vec3(0.0, 1.0, 0.0)));
         wall->SetPosition(glm::vec3(wall_coordinate_complement[i][0], -20, wall_coordinate_complement[i][1]));
         wall->Scale(glm::vec3(10, 10, 10));
+        wall->SetStatic(true);
         wall_arr_complement.push_back(wall);
     }
 }
@@ -15,6 +15,11 @@
 #include "box.h"
 #include "tree.h"
 #include "light.h"
+#include "trigger_system.h"
+#include "job_system.h"
+#include "camera_path.h"
+#include "benchmark.h"
+#include "input_queue.h"
 namespace game {
 
     // Exception type for the game
@@ -43,6 +48,28 @@ namespace game {
             void SetupScene(void);
             // Run the game: keep the application active
             void MainLoop(void); 
+            // Render offscreen, without a window or input, for benchmarks
+            // and frame captures: stop after 'frames' frames, or after
+            // 'seconds' of wall time if 'frames' is zero, and save the last
+            // frame to 'capture' unless it is empty. Game time advances by
+            // a fixed step per frame. Call before Init()
+            void SetHeadless(int frames, double seconds, std::string capture);
+            // Compare the last frame of an offscreen run with the capture
+            // in 'reference_file' and print the largest difference of a
+            // color channel and the share of pixels that differ
+            void SetComparison(std::string reference_file);
+            // Merge the static level pieces before the game starts; on by
+            // default. Call before SetupScene()
+            void SetBaking(bool bake);
+            // Walk the path in 'path_file' instead of taking input, with
+            // game time stepped as in headless mode, and write the frame
+            // time, draw call and triangle statistics as JSON to
+            // 'report_file', or to the standard output if it is empty.
+            // Call before Init()
+            void SetBenchmark(std::string path_file, std::string report_file);
+            // Save the walk of the player and the keys pressed as a path
+            // to 'path_file' when the game ends
+            void SetRecording(std::string path_file);
 
             void Branches_grow(Tree* main_tree, int num, int current_num);
 
@@ -50,6 +77,45 @@ namespace game {
             // GLFW window
             GLFWwindow* window_;
 
+            // Offscreen rendering
+            bool headless_;
+            int headless_frames_;
+            double headless_seconds_;
+            std::string capture_file_;
+            std::string compare_file_;
+            bool bake_static_;
+            int frame_; // Frames drawn so far
+            double start_time_; // Wall time when the main loop started
+            // Frame buffer standing in for the window
+            GLuint screen_buffer_;
+            GLuint screen_color_;
+            GLuint screen_depth_;
+
+            // Scripted runs
+            bool benchmark_;
+            std::string path_file_;
+            std::string report_file_;
+            Benchmark results_;
+            std::string record_file_; // Empty when not recording
+            CameraPath path_;
+            std::vector<PathEvent> path_events_;
+            // Last pose and block added to the recorded path
+            int recorded_frame_;
+            glm::vec2 recorded_position_;
+            float recorded_yaw_;
+            std::string recorded_block_;
+
+
+            // Worker threads for the per-frame updates
+            JobSystem jobs_;
+            // Thread that runs the simulation steps while a frame is drawn,
+            // and the number of steps it runs next
+            FrameTask simulation_;
+            int simulation_steps_;
+
+            // Key events waiting for the main loop
+            InputQueue input_;
+            std::vector<InputEvent> input_events_;
 
             // Scene graph containing all nodes to render
             SceneGraph scene_;
@@ -61,6 +127,20 @@ namespace game {
             Camera camera_;
             Light light_;
 
+            // Faces of the sky box
+            enum SkyFace { SkyFront, SkyBack, SkyLeft, SkyRight, SkyTop, SkyBottom, NumSkyFaces };
+
+            // Handles of the nodes that are accessed every frame
+            NodeHandle cover_node_;
+            NodeHandle fire_node_;
+            NodeHandle door_node_;
+            NodeHandle floor_node_[3];
+            NodeHandle magic_node_[2];
+            NodeHandle sky_node_[NumSkyFaces];
+
+            // Interaction volumes around the player
+            TriggerSystem triggers_;
+
             // Flag to turn animation on/off
             bool animating_;
             bool effect;
@@ -68,11 +148,44 @@ namespace game {
 
             // Methods to initialize the game
             void InitWindow(void);
+            // Create a context without a window and the frame buffer the
+            // game draws to instead
+            void InitHeadless(void);
             void InitView(void);
             void InitEventHandlers(void);
+            // Whether the main loop goes on
+            bool KeepRunning(void);
+            // Report the timing of an offscreen run and save its last frame
+            void FinishHeadless(void);
+            // Read the offscreen frame, as rows of RGB bytes from the top
+            void ReadScreen(std::vector<unsigned char> &data);
+            // Save the offscreen frame to a file in binary ppm format
+            void SaveScreen(std::string filename);
+            // Compare the offscreen frame with a file saved by SaveScreen
+            void CompareScreen(std::string filename);
+            // Move the player along the path and replay its events for
+            // the current frame
+            void PlayPath(void);
+            // Add the pose of the player to the recorded path if it
+            // changed, and the block if the player entered another one
+            void RecordPath(void);
+            // Advance the animation and the scene by one fixed step
+            void Simulate(void);
+            // Look up the handles of the nodes used by the main loop
+            void ResolveNodeHandles(void);
+            // Update the interaction of the player from the triggers it
+            // entered and left
+            void UpdateTriggers(void);
  
             // Methods to handle events
+            // The callback only queues the key; the main loop applies the
+            // queue at the start of a frame, and turns that come in late
+            // just before the view of the frame is set
             static void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+            void ApplyInput(void);
+            void LatchCamera(void);
+            // Act on a key, pressed or scripted
+            static void ProcessKey(Game *game, int key, int action);
             static void ResizeCallback(GLFWwindow* window, int width, int height);
 
             // Asteroid field
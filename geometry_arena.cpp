@@ -0,0 +1,402 @@
+#include <algorithm>
+
+#include "geometry_arena.h"
+#include "program_info.h"
+
+namespace game {
+
+// Pool of the indices
+#define INDEX_POOL 0
+// Smallest buffer, in elements
+#define MIN_POOL_CAPACITY 65536
+
+// Layout of the vertex attributes in a vertex buffer
+struct VertexLayout {
+    ProgramAttribute attribute;
+    int components;
+    int offset; // In floats
+};
+
+static const VertexLayout vertex_layout[] = {
+    { VertexAttribute, 3, 0 },
+    { NormalAttribute, 3, 3 },
+    { ColorAttribute, 3, 6 },
+    { UvAttribute, 2, 9 },
+    { ParticlePropertyAttribute, 3, 11 },
+    { LifespanAttribute, 1, 14 }
+};
+
+
+GeometryArena::GeometryArena(void){
+
+    Pool index;
+    index.buffer = 0;
+    index.element_size = sizeof(GLuint);
+    index.capacity = 0;
+    pool_.push_back(index);
+    version_ = 0;
+}
+
+
+GeometryArena::~GeometryArena(){
+
+    for (std::map<std::pair<int, GLuint>, GLuint>::iterator it = vertex_array_.begin(); it != vertex_array_.end(); it++){
+        glDeleteVertexArrays(1, &it->second);
+    }
+    for (int i = 0; i < pool_.size(); i++){
+        if (pool_[i].buffer){
+            glDeleteBuffers(1, &pool_[i].buffer);
+        }
+    }
+}
+
+
+int GeometryArena::Add(const GLfloat *vertex, int num_vertices, int vertex_size, const GLuint *index, int num_indices){
+
+    Geometry geometry;
+    geometry.used = true;
+    geometry.vertex_pool = GetVertexPool(vertex_size);
+    geometry.num_vertices = num_vertices;
+    geometry.num_indices = index ? num_indices : 0;
+    geometry.vertex_offset = Allocate(geometry.vertex_pool, geometry.num_vertices);
+    geometry.index_offset = Allocate(INDEX_POOL, geometry.num_indices);
+
+    // Indices stay relative to the first vertex of the geometry; draws add
+    // the base vertex
+    Upload(geometry.vertex_pool, geometry.vertex_offset, geometry.num_vertices, vertex);
+    Upload(INDEX_POOL, geometry.index_offset, geometry.num_indices, index);
+
+    if (free_geometry_.size() > 0){
+        int id = free_geometry_.back();
+        free_geometry_.pop_back();
+        geometry_[id] = geometry;
+        return id;
+    }
+    geometry_.push_back(geometry);
+    return geometry_.size() - 1;
+}
+
+
+void GeometryArena::Remove(int geometry){
+
+    // Removing twice would free the ranges twice
+    Geometry &g = geometry_[geometry];
+    if (!g.used){
+        return;
+    }
+    Release(g.vertex_pool, g.vertex_offset, g.num_vertices);
+    Release(INDEX_POOL, g.index_offset, g.num_indices);
+    g.used = false;
+    free_geometry_.push_back(geometry);
+}
+
+
+void GeometryArena::Read(int geometry, std::vector<GLfloat> &vertex, std::vector<GLuint> &index) const {
+
+    const Geometry &g = geometry_[geometry];
+    const Pool &p = pool_[g.vertex_pool];
+    vertex.resize(g.num_vertices * p.element_size / sizeof(GLfloat));
+    index.resize(g.num_indices);
+    if (g.num_vertices > 0){
+        glBindBuffer(GL_COPY_READ_BUFFER, p.buffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, g.vertex_offset * p.element_size, g.num_vertices * p.element_size, &vertex[0]);
+    }
+    if (g.num_indices > 0){
+        glBindBuffer(GL_COPY_READ_BUFFER, pool_[INDEX_POOL].buffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, g.index_offset * sizeof(GLuint), g.num_indices * sizeof(GLuint), &index[0]);
+    }
+}
+
+
+void GeometryArena::Compact(void){
+
+    for (int i = 0; i < pool_.size(); i++){
+        CompactPool(i);
+    }
+}
+
+
+GLint GeometryArena::GetBaseVertex(int geometry) const {
+
+    return geometry_[geometry].vertex_offset;
+}
+
+
+GLuint GeometryArena::GetFirstIndex(int geometry) const {
+
+    return geometry_[geometry].index_offset;
+}
+
+
+int GeometryArena::GetVertexSize(int geometry) const {
+
+    return pool_[geometry_[geometry].vertex_pool].element_size / sizeof(GLfloat);
+}
+
+
+GLuint GeometryArena::GetArrayBuffer(int geometry) const {
+
+    return pool_[geometry_[geometry].vertex_pool].buffer;
+}
+
+
+GLuint GeometryArena::GetElementArrayBuffer(void) const {
+
+    return pool_[INDEX_POOL].buffer;
+}
+
+
+int GeometryArena::GetVersion(void) const {
+
+    return version_;
+}
+
+
+GLuint GeometryArena::GetVertexArray(int geometry, GLuint program){
+
+    if (!program){
+        return 0;
+    }
+    int pool = geometry_[geometry].vertex_pool;
+    std::pair<int, GLuint> key(pool, program);
+    std::map<std::pair<int, GLuint>, GLuint>::iterator it = vertex_array_.find(key);
+    if (it != vertex_array_.end()){
+        return it->second;
+    }
+
+    // The element buffer is part of the vertex array, so it must exist
+    // even if only point sets were added so far
+    if (!pool_[INDEX_POOL].buffer){
+        Grow(INDEX_POOL, MIN_POOL_CAPACITY);
+    }
+
+    // Record the buffers and the attribute pointers the program reads;
+    // attributes the program does not use are left disabled
+    const ProgramInfo &info = ProgramInfo::Get(program);
+    int vertex_size = pool_[pool].element_size / sizeof(GLfloat);
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, pool_[pool].buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool_[INDEX_POOL].buffer);
+    for (int i = 0; i < sizeof(vertex_layout) / sizeof(vertex_layout[0]); i++){
+        const VertexLayout &layout = vertex_layout[i];
+        GLint att = info.GetAttribute(layout.attribute);
+        if (att < 0 || layout.offset + layout.components > vertex_size){
+            continue;
+        }
+        glVertexAttribPointer(att, layout.components, GL_FLOAT, GL_FALSE, vertex_size * sizeof(GLfloat), (void *) (layout.offset * sizeof(GLfloat)));
+        glEnableVertexAttribArray(att);
+    }
+    glBindVertexArray(0);
+
+    vertex_array_[key] = vao;
+    return vao;
+}
+
+
+int GeometryArena::GetVertexPool(int vertex_size){
+
+    int element_size = vertex_size * sizeof(GLfloat);
+    for (int i = INDEX_POOL + 1; i < pool_.size(); i++){
+        if (pool_[i].element_size == element_size){
+            return i;
+        }
+    }
+
+    Pool pool;
+    pool.buffer = 0;
+    pool.element_size = element_size;
+    pool.capacity = 0;
+    pool_.push_back(pool);
+    return pool_.size() - 1;
+}
+
+
+int GeometryArena::Allocate(int pool, int count){
+
+    if (count == 0){
+        return 0;
+    }
+
+    // First fit
+    std::vector<Range> *free = &pool_[pool].free;
+    int found = -1;
+    int total = 0;
+    for (int i = 0; i < free->size() && found < 0; i++){
+        if ((*free)[i].count >= count){
+            found = i;
+        }
+        total += (*free)[i].count;
+    }
+
+    if (found < 0){
+        // Enough space in holes: gather it at the end of the buffer.
+        // Otherwise grow, which extends the range at the end
+        if (total >= count){
+            CompactPool(pool);
+        } else {
+            Grow(pool, pool_[pool].capacity + count);
+        }
+        free = &pool_[pool].free;
+        found = free->size() - 1;
+    }
+
+    Range &range = (*free)[found];
+    int offset = range.offset;
+    range.offset += count;
+    range.count -= count;
+    if (range.count == 0){
+        free->erase(free->begin() + found);
+    }
+    return offset;
+}
+
+
+void GeometryArena::Release(int pool, int offset, int count){
+
+    if (count == 0){
+        return;
+    }
+
+    // Insert in offset order and merge with the neighbours
+    std::vector<Range> &free = pool_[pool].free;
+    int i = 0;
+    while (i < free.size() && free[i].offset < offset){
+        i++;
+    }
+    Range range;
+    range.offset = offset;
+    range.count = count;
+    free.insert(free.begin() + i, range);
+
+    if (i + 1 < free.size() && free[i].offset + free[i].count == free[i + 1].offset){
+        free[i].count += free[i + 1].count;
+        free.erase(free.begin() + i + 1);
+    }
+    if (i > 0 && free[i - 1].offset + free[i - 1].count == free[i].offset){
+        free[i - 1].count += free[i].count;
+        free.erase(free.begin() + i);
+    }
+}
+
+
+void GeometryArena::Grow(int pool, int capacity){
+
+    Pool &p = pool_[pool];
+    int old_capacity = p.capacity;
+    capacity = std::max(std::max(capacity, old_capacity * 2), MIN_POOL_CAPACITY);
+
+    // Copy buffer operations do not disturb the element buffer of the
+    // bound vertex array
+    if (!p.buffer){
+        glGenBuffers(1, &p.buffer);
+    }
+    if (old_capacity > 0){
+        // Park the contents in a temporary buffer while the storage is
+        // reallocated under the same name
+        GLuint temp;
+        glGenBuffers(1, &temp);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, temp);
+        glBufferData(GL_COPY_WRITE_BUFFER, old_capacity * p.element_size, NULL, GL_STATIC_COPY);
+        glBindBuffer(GL_COPY_READ_BUFFER, p.buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_capacity * p.element_size);
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, p.buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity * p.element_size, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_READ_BUFFER, temp);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_capacity * p.element_size);
+        glDeleteBuffers(1, &temp);
+    } else {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, p.buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity * p.element_size, NULL, GL_STATIC_DRAW);
+    }
+
+    p.capacity = capacity;
+    Release(pool, old_capacity, capacity - old_capacity);
+}
+
+
+void GeometryArena::CompactPool(int pool){
+
+    // Ranges of the pool in use, by offset, with where their offset is
+    // stored
+    struct Used {
+        int offset;
+        int count;
+        int *owner;
+        bool operator<(const Used &other) const { return offset < other.offset; }
+    };
+    std::vector<Used> used;
+    for (int i = 0; i < geometry_.size(); i++){
+        Geometry &g = geometry_[i];
+        Used u;
+        if (!g.used){
+            continue;
+        } else if (pool == INDEX_POOL){
+            u.offset = g.index_offset;
+            u.count = g.num_indices;
+            u.owner = &g.index_offset;
+        } else if (pool == g.vertex_pool){
+            u.offset = g.vertex_offset;
+            u.count = g.num_vertices;
+            u.owner = &g.vertex_offset;
+        } else {
+            continue;
+        }
+        if (u.count > 0){
+            used.push_back(u);
+        }
+    }
+    std::sort(used.begin(), used.end());
+
+    // Pack the ranges into a temporary buffer, then copy it back to the
+    // start of the pool; ranges can overlap their new place, so they
+    // cannot be moved within the pool directly
+    Pool &p = pool_[pool];
+    int size = 0;
+    for (int i = 0; i < used.size(); i++){
+        size += used[i].count;
+    }
+    if (size > 0){
+        GLuint temp;
+        glGenBuffers(1, &temp);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, temp);
+        glBufferData(GL_COPY_WRITE_BUFFER, size * p.element_size, NULL, GL_STATIC_COPY);
+        glBindBuffer(GL_COPY_READ_BUFFER, p.buffer);
+        int offset = 0;
+        for (int i = 0; i < used.size(); i++){
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, used[i].offset * p.element_size, offset * p.element_size, used[i].count * p.element_size);
+            *used[i].owner = offset;
+            offset += used[i].count;
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, temp);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, p.buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size * p.element_size);
+        glDeleteBuffers(1, &temp);
+        version_++;
+    }
+
+    // All free space is now one range at the end
+    p.free.clear();
+    if (size < p.capacity){
+        Range range;
+        range.offset = size;
+        range.count = p.capacity - size;
+        p.free.push_back(range);
+    }
+}
+
+
+void GeometryArena::Upload(int pool, int offset, int count, const void *data){
+
+    if (count == 0){
+        return;
+    }
+    Pool &p = pool_[pool];
+    glBindBuffer(GL_COPY_WRITE_BUFFER, p.buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, offset * p.element_size, count * p.element_size, data);
+}
+
+} // namespace game
@@ -0,0 +1,109 @@
+#ifndef GEOMETRY_ARENA_H_
+#define GEOMETRY_ARENA_H_
+
+#include <vector>
+#include <map>
+#include <utility>
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+namespace game {
+
+    // Vertices and indices of all geometry resources, suballocated from a
+    // few large buffers
+    // Geometry with the same vertex size shares one vertex buffer, and all
+    // geometry shares one element buffer, so nodes drawn with the same
+    // program use the same vertex array object; a geometry is a range of
+    // vertices, drawn from its base vertex, and a range of indices
+    // Each buffer keeps a free list of ranges, allocated first fit. When no
+    // range is large enough but enough space is free in total, the buffer
+    // is compacted; otherwise it grows. Buffers keep their name when they
+    // grow, so vertex arrays stay valid
+    class GeometryArena {
+
+        public:
+            GeometryArena(void);
+            ~GeometryArena();
+
+            // Copy a geometry into the arena and return its index;
+            // 'vertex_size' is the number of floats per vertex, and 'index'
+            // may be NULL for point sets
+            int Add(const GLfloat *vertex, int num_vertices, int vertex_size, const GLuint *index, int num_indices);
+            // Give the ranges of a geometry back to the free lists; a geometry
+            // that was already removed is left alone
+            void Remove(int geometry);
+            // Copy the vertices and indices of a geometry back from the
+            // buffers
+            void Read(int geometry, std::vector<GLfloat> &vertex, std::vector<GLuint> &index) const;
+            // Move the geometry to the start of the buffers, closing the
+            // holes left by removed geometry
+            void Compact(void);
+
+            // Position of a geometry in the buffers; changes when the arena
+            // is compacted
+            GLint GetBaseVertex(int geometry) const;
+            GLuint GetFirstIndex(int geometry) const;
+            int GetVertexSize(int geometry) const;
+            // Buffers holding a geometry
+            GLuint GetArrayBuffer(int geometry) const;
+            GLuint GetElementArrayBuffer(void) const;
+            // Number of compactions so far; offsets read before the last
+            // one are stale
+            int GetVersion(void) const;
+
+            // Vertex array object that feeds the vertex buffer of a geometry
+            // to a shader program; built on first request and shared by all
+            // geometry in the same buffer
+            GLuint GetVertexArray(int geometry, GLuint program);
+
+        private:
+            // Range of elements of a buffer
+            struct Range {
+                int offset;
+                int count;
+            };
+
+            // Buffer with its free list
+            struct Pool {
+                GLuint buffer;
+                int element_size; // In bytes
+                int capacity; // In elements
+                std::vector<Range> free; // Sorted by offset, never adjacent
+            };
+
+            struct Geometry {
+                bool used;
+                int vertex_pool;
+                int vertex_offset;
+                int num_vertices;
+                int index_offset;
+                int num_indices;
+            };
+
+            // Pool 0 holds the indices; the others hold vertices of one size
+            std::vector<Pool> pool_;
+            std::vector<Geometry> geometry_;
+            std::vector<int> free_geometry_; // Indices of unused geometry
+            int version_; // Number of compactions
+            // Vertex arrays by vertex pool and program
+            std::map<std::pair<int, GLuint>, GLuint> vertex_array_;
+
+            // Pool of vertices of a size, created if needed
+            int GetVertexPool(int vertex_size);
+            // Reserve 'count' elements of a pool and return the offset of
+            // the first one
+            int Allocate(int pool, int count);
+            // Add a range to the free list of a pool
+            void Release(int pool, int offset, int count);
+            // Resize the buffer of a pool to hold at least 'capacity'
+            // elements, keeping its contents
+            void Grow(int pool, int capacity);
+            void CompactPool(int pool);
+            // Copy elements into a pool
+            void Upload(int pool, int offset, int count, const void *data);
+
+    }; // class GeometryArena
+
+} // namespace game
+
+#endif // GEOMETRY_ARENA_H_
@@ -0,0 +1,91 @@
+#include <cstddef>
+
+#include "handle_table.h"
+
+namespace game {
+
+HandleTable::HandleTable(void){
+}
+
+
+HandleTable::~HandleTable(){
+}
+
+
+NodeHandle HandleTable::Insert(SceneNode *node){
+
+    unsigned int index;
+
+    // Reuse a free slot if there is one
+    if (free_.size() > 0){
+        index = free_.back();
+        free_.pop_back();
+    } else {
+        Slot slot;
+        slot.node = NULL;
+        slot.generation = 0;
+        slot_.push_back(slot);
+        index = slot_.size() - 1;
+    }
+
+    // Generation zero is reserved for null handles
+    slot_[index].generation++;
+    if (slot_[index].generation == 0){
+        slot_[index].generation = 1;
+    }
+    slot_[index].node = node;
+
+    return NodeHandle(index, slot_[index].generation);
+}
+
+
+SceneNode *HandleTable::Remove(NodeHandle handle){
+
+    if (!IsValid(handle)){
+        return NULL;
+    }
+
+    SceneNode *node = slot_[handle.index].node;
+
+    // Bump the generation so that copies of this handle become stale
+    slot_[handle.index].node = NULL;
+    slot_[handle.index].generation++;
+    free_.push_back(handle.index);
+
+    return node;
+}
+
+
+SceneNode *HandleTable::Get(NodeHandle handle) const {
+
+    if (!IsValid(handle)){
+        return NULL;
+    }
+    return slot_[handle.index].node;
+}
+
+
+SceneNode *HandleTable::GetAt(unsigned int index) const {
+
+    if (index >= slot_.size()){
+        return NULL;
+    }
+    return slot_[index].node;
+}
+
+
+bool HandleTable::IsValid(NodeHandle handle) const {
+
+    return !handle.IsNull() &&
+           handle.index < slot_.size() &&
+           slot_[handle.index].generation == handle.generation &&
+           slot_[handle.index].node != NULL;
+}
+
+
+unsigned int HandleTable::GetCapacity(void) const {
+
+    return slot_.size();
+}
+
+} // namespace game
@@ -0,0 +1,49 @@
+#ifndef HANDLE_TABLE_H_
+#define HANDLE_TABLE_H_
+
+#include <vector>
+
+#include "node_handle.h"
+
+namespace game {
+
+    class SceneNode;
+
+    // Table that maps node handles to scene nodes in constant time
+    // Slots of removed nodes are recycled, and their generation is bumped so
+    // that old handles stop resolving
+    class HandleTable {
+
+        public:
+            HandleTable(void);
+            ~HandleTable();
+
+            // Store a node and return its handle
+            NodeHandle Insert(SceneNode *node);
+            // Release the slot of a handle; returns the node it referred to
+            SceneNode *Remove(NodeHandle handle);
+            // Get the node of a handle, or NULL if the handle is stale
+            SceneNode *Get(NodeHandle handle) const;
+            // Get the node in a slot, or NULL if the slot is free
+            SceneNode *GetAt(unsigned int index) const;
+            bool IsValid(NodeHandle handle) const;
+
+            // Number of slots, including free ones
+            unsigned int GetCapacity(void) const;
+
+        private:
+            struct Slot {
+                SceneNode *node;
+                unsigned int generation;
+            };
+
+            // Slots indexed by handle index
+            std::vector<Slot> slot_;
+            // Indices of slots that can be reused
+            std::vector<unsigned int> free_;
+
+    }; // class HandleTable
+
+} // namespace game
+
+#endif // HANDLE_TABLE_H_
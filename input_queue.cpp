@@ -0,0 +1,92 @@
+#include <algorithm>
+
+#include "input_queue.h"
+#include "clock.h"
+
+namespace game {
+
+// Latencies kept for the statistics
+#define INPUT_HISTORY 256
+
+
+InputQueue::InputQueue(void){
+
+    next_ = 0;
+    measured_ = 0;
+}
+
+
+void InputQueue::Push(int key, int action){
+
+    InputEvent event;
+    event.key = key;
+    event.action = action;
+    event.time = Clock::GetWallTime();
+    queue_.push_back(event);
+}
+
+
+void InputQueue::Take(std::vector<InputEvent> &events){
+
+    events.clear();
+    for (int i = 0; i < queue_.size(); i++){
+        events.push_back(queue_[i]);
+        pending_.push_back(queue_[i].time);
+    }
+    queue_.clear();
+}
+
+
+void InputQueue::TakeLeading(const int *keys, int num_keys, std::vector<InputEvent> &events){
+
+    events.clear();
+    while (queue_.size() > 0 && std::find(keys, keys + num_keys, queue_.front().key) != keys + num_keys){
+        events.push_back(queue_.front());
+        pending_.push_back(queue_.front().time);
+        queue_.pop_front();
+    }
+}
+
+
+void InputQueue::Presented(void){
+
+    double time = Clock::GetWallTime();
+    for (int i = 0; i < pending_.size(); i++){
+        double latency = time - pending_[i];
+        if (latency_.size() < INPUT_HISTORY){
+            latency_.push_back(latency);
+        } else {
+            latency_[next_] = latency;
+            next_ = (next_ + 1) % INPUT_HISTORY;
+        }
+        measured_++;
+    }
+    pending_.clear();
+}
+
+
+LatencyStats InputQueue::GetLatency(void) const {
+
+    LatencyStats stats;
+    stats.events = measured_;
+    stats.mean = stats.p50 = stats.p95 = stats.max = 0.0;
+    int n = latency_.size();
+    if (n == 0){
+        return stats;
+    }
+
+    std::vector<double> sorted = latency_;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0.0;
+    for (int i = 0; i < n; i++){
+        sum += sorted[i];
+    }
+    stats.mean = sum / n * 1000.0;
+    // Nearest rank
+    stats.p50 = sorted[std::max(0, (n * 50 + 99) / 100 - 1)] * 1000.0;
+    stats.p95 = sorted[std::max(0, (n * 95 + 99) / 100 - 1)] * 1000.0;
+    stats.max = sorted[n - 1] * 1000.0;
+    return stats;
+}
+
+} // namespace game
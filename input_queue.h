@@ -0,0 +1,62 @@
+#ifndef INPUT_QUEUE_H_
+#define INPUT_QUEUE_H_
+
+#include <vector>
+#include <deque>
+
+namespace game {
+
+    // Key event of the window, with the wall time it came in
+    struct InputEvent {
+        int key;
+        int action;
+        double time;
+    };
+
+    // Time from input events to the swap of the first frame that shows
+    // them, over the recent events, in milliseconds
+    struct LatencyStats {
+        int events; // Measured since the start
+        double mean;
+        double p50;
+        double p95;
+        double max;
+    };
+
+    // Input events queued by the GLFW callbacks, so the game applies them
+    // at set points of the frame instead of whenever events are polled
+    // Events taken from the queue are taken to be shown by the frame being
+    // made; Presented marks the time that frame was swapped, which gives
+    // the latency of each of them
+    class InputQueue {
+
+        public:
+            InputQueue(void);
+
+            // Add an event as it comes in
+            void Push(int key, int action);
+            // Take every queued event, oldest first
+            void Take(std::vector<InputEvent> &events);
+            // Take the events at the front of the queue whose key is one
+            // of 'keys', up to the first one that is not; later events keep
+            // their order behind it
+            void TakeLeading(const int *keys, int num_keys, std::vector<InputEvent> &events);
+
+            // The frame the taken events went into was swapped
+            void Presented(void);
+            LatencyStats GetLatency(void) const;
+
+        private:
+            std::deque<InputEvent> queue_;
+            // Arrival times of the events taken for the frame being made
+            std::vector<double> pending_;
+            // Recent latencies, oldest overwritten first
+            std::vector<double> latency_;
+            int next_;
+            int measured_;
+
+    }; // class InputQueue
+
+} // namespace game
+
+#endif // INPUT_QUEUE_H_
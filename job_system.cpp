@@ -0,0 +1,300 @@
+#include <algorithm>
+#include <chrono>
+
+#include "job_system.h"
+
+namespace game {
+
+// Checks of the request counter a FrameTask spins for before it sleeps
+#define FRAME_TASK_SPINS 4096
+// Sleep between checks after that, in microseconds
+#define FRAME_TASK_SLEEP 100
+
+// Pool and queue of the current thread, for worker threads
+static thread_local const JobSystem *current_system = NULL;
+static thread_local int current_queue = -1;
+
+
+TaskGroup::TaskGroup(void){
+
+    pending_ = 0;
+}
+
+
+int TaskGroup::GetPending(void) const {
+
+    return pending_;
+}
+
+
+JobSystem::JobSystem(int num_workers){
+
+    if (num_workers < 0){
+        num_workers = std::max(0, (int) std::thread::hardware_concurrency() - 1);
+    }
+
+    quit_ = false;
+    queued_ = 0;
+    for (int i = 0; i <= num_workers; i++){
+        queue_.push_back(new Queue());
+    }
+    for (int i = 0; i < num_workers; i++){
+        worker_.push_back(std::thread(&JobSystem::WorkerLoop, this, i));
+    }
+}
+
+
+JobSystem::~JobSystem(){
+
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        quit_ = true;
+    }
+    wake_.notify_all();
+    for (int i = 0; i < worker_.size(); i++){
+        worker_[i].join();
+    }
+    for (int i = 0; i < queue_.size(); i++){
+        delete queue_[i];
+    }
+}
+
+
+int JobSystem::GetWorkerCount(void) const {
+
+    return worker_.size();
+}
+
+
+int JobSystem::GetQueueIndex(void) const {
+
+    if (current_system == this){
+        return current_queue;
+    }
+    return queue_.size() - 1;
+}
+
+
+void JobSystem::Run(TaskGroup &group, Job job){
+
+    Task task;
+    task.job = job;
+    task.group = &group;
+    group.pending_++;
+
+    Queue *queue = queue_[GetQueueIndex()];
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->task.push_back(task);
+    }
+
+    // Count the job under the sleep lock, so that a worker about to sleep
+    // cannot miss it
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        queued_++;
+    }
+    wake_.notify_one();
+}
+
+
+bool JobSystem::Pop(int index, Task &task){
+
+    Queue *queue = queue_[index];
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (queue->task.empty()){
+        return false;
+    }
+    task = queue->task.back();
+    queue->task.pop_back();
+    queued_--;
+    return true;
+}
+
+
+bool JobSystem::Steal(int index, Task &task){
+
+    // Try the other queues, starting after our own
+    int count = queue_.size();
+    for (int i = 1; i < count; i++){
+        Queue *queue = queue_[(index + i) % count];
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if (!queue->task.empty()){
+            task = queue->task.front();
+            queue->task.pop_front();
+            queued_--;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool JobSystem::Acquire(int index, Task &task){
+
+    return Pop(index, task) || Steal(index, task);
+}
+
+
+void JobSystem::Execute(Task &task){
+
+    try {
+        task.job();
+    }
+    catch (...){
+        std::lock_guard<std::mutex> lock(task.group->error_mutex_);
+        if (!task.group->error_){
+            task.group->error_ = std::current_exception();
+        }
+    }
+    task.group->pending_--;
+}
+
+
+void JobSystem::Wait(TaskGroup &group){
+
+    int index = GetQueueIndex();
+    while (group.pending_ > 0){
+        Task task;
+        if (Acquire(index, task)){
+            Execute(task);
+        } else {
+            // The remaining jobs are running on other threads
+            std::this_thread::yield();
+        }
+    }
+
+    if (group.error_){
+        std::exception_ptr error = group.error_;
+        group.error_ = NULL;
+        std::rethrow_exception(error);
+    }
+}
+
+
+void JobSystem::ParallelFor(int count, int grain, const std::function<void(int begin, int end)> &body){
+
+    grain = std::max(1, grain);
+    if (worker_.size() == 0 || count <= grain){
+        if (count > 0){
+            body(0, count);
+        }
+        return;
+    }
+
+    TaskGroup group;
+    for (int begin = 0; begin < count; begin += grain){
+        int end = std::min(count, begin + grain);
+        Run(group, [&body, begin, end](){ body(begin, end); });
+    }
+    Wait(group);
+}
+
+
+void JobSystem::WorkerLoop(int index){
+
+    current_system = this;
+    current_queue = index;
+
+    while (true){
+        Task task;
+        if (Acquire(index, task)){
+            Execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        wake_.wait(lock, [this](){ return quit_ || queued_ > 0; });
+        if (quit_){
+            break;
+        }
+    }
+}
+
+FrameTask::FrameTask(void){
+
+    quit_ = false;
+    requested_ = 0;
+    finished_ = 0;
+}
+
+
+FrameTask::~FrameTask(){
+
+    Stop();
+}
+
+
+void FrameTask::Start(Job job){
+
+    Stop();
+    job_ = job;
+    quit_ = false;
+    requested_ = 0;
+    finished_ = 0;
+    error_ = NULL;
+    thread_ = std::thread(&FrameTask::ThreadLoop, this);
+}
+
+
+void FrameTask::Stop(void){
+
+    if (!thread_.joinable()){
+        return;
+    }
+    quit_.store(true, std::memory_order_release);
+    thread_.join();
+}
+
+
+void FrameTask::Run(void){
+
+    // Everything written before this point is visible to the job
+    requested_.fetch_add(1, std::memory_order_release);
+}
+
+
+void FrameTask::Wait(void){
+
+    unsigned int target = requested_.load(std::memory_order_relaxed);
+    while (finished_.load(std::memory_order_acquire) != target){
+        std::this_thread::yield();
+    }
+
+    if (error_){
+        std::exception_ptr error = error_;
+        error_ = NULL;
+        std::rethrow_exception(error);
+    }
+}
+
+
+void FrameTask::ThreadLoop(void){
+
+    unsigned int done = 0;
+    while (true){
+        int spins = 0;
+        while (requested_.load(std::memory_order_acquire) == done){
+            if (quit_.load(std::memory_order_acquire)){
+                return;
+            }
+            if (spins < FRAME_TASK_SPINS){
+                spins++;
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(FRAME_TASK_SLEEP));
+            }
+        }
+
+        try {
+            job_();
+        }
+        catch (...){
+            error_ = std::current_exception();
+        }
+        done++;
+        finished_.store(done, std::memory_order_release);
+    }
+}
+
+} // namespace game
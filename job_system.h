@@ -0,0 +1,133 @@
+#ifndef JOB_SYSTEM_H_
+#define JOB_SYSTEM_H_
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+
+namespace game {
+
+    typedef std::function<void(void)> Job;
+
+    // Set of jobs that can be waited for together
+    class TaskGroup {
+
+        public:
+            TaskGroup(void);
+
+            // Number of jobs of the group not finished yet
+            int GetPending(void) const;
+
+        private:
+            friend class JobSystem;
+
+            std::atomic<int> pending_;
+            // First exception thrown by a job of the group
+            std::exception_ptr error_;
+            std::mutex error_mutex_;
+
+    }; // class TaskGroup
+
+    // Pool of worker threads that run jobs
+    // Every thread has its own deque of jobs: it pushes and pops at the
+    // back, while idle threads steal from the front of the others. A
+    // thread waiting for a group runs jobs instead of blocking, so jobs can
+    // wait for jobs they spawned
+    class JobSystem {
+
+        public:
+            // Start 'num_workers' threads; a negative count uses one per
+            // core besides the calling thread. With no workers, jobs run on
+            // the thread that waits for them
+            JobSystem(int num_workers = -1);
+            ~JobSystem();
+
+            // Queue a job as part of a group
+            void Run(TaskGroup &group, Job job);
+            // Run jobs until all the jobs of the group are done; rethrows
+            // the first exception thrown by one of them
+            void Wait(TaskGroup &group);
+
+            // Call 'body' over [0, count) in ranges of at most 'grain'
+            // items, in parallel, and wait for all of them
+            void ParallelFor(int count, int grain, const std::function<void(int begin, int end)> &body);
+
+            int GetWorkerCount(void) const;
+
+        private:
+            struct Task {
+                Job job;
+                TaskGroup *group;
+            };
+
+            struct Queue {
+                std::mutex mutex;
+                std::deque<Task> task;
+            };
+
+            // One queue per worker, plus a last one shared by the threads
+            // outside the pool
+            std::vector<Queue *> queue_;
+            std::vector<std::thread> worker_;
+
+            std::atomic<bool> quit_;
+            // Number of jobs in all queues
+            std::atomic<int> queued_;
+            std::mutex sleep_mutex_;
+            std::condition_variable wake_;
+
+            // Queue of the calling thread
+            int GetQueueIndex(void) const;
+            bool Pop(int index, Task &task);
+            bool Steal(int index, Task &task);
+            // Pop a job from the own queue or steal one
+            bool Acquire(int index, Task &task);
+            void Execute(Task &task);
+            void WorkerLoop(int index);
+
+    }; // class JobSystem
+
+    // Thread that runs the same job once per frame, handed over without
+    // locks
+    // Run bumps a request counter and Wait spins until the finished counter
+    // catches up; neither takes a mutex or makes a system call. Between
+    // jobs the thread spins for a while, then polls with short sleeps
+    class FrameTask {
+
+        public:
+            FrameTask(void);
+            ~FrameTask();
+
+            // Start the thread that runs 'job'; Stop ends it
+            void Start(Job job);
+            void Stop(void);
+
+            // Have the thread run the job once; only one thread may call
+            // Run and Wait, and the job must not be running
+            void Run(void);
+            // Wait until the job that was run is done; rethrows the
+            // exception it threw
+            void Wait(void);
+
+        private:
+            Job job_;
+            std::thread thread_;
+            std::atomic<bool> quit_;
+            // Runs asked for and runs done
+            std::atomic<unsigned int> requested_;
+            std::atomic<unsigned int> finished_;
+            // Exception of the last run, published by 'finished_'
+            std::exception_ptr error_;
+
+            void ThreadLoop(void);
+
+    }; // class FrameTask
+
+} // namespace game
+
+#endif // JOB_SYSTEM_H_
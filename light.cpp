@@ -47,18 +47,6 @@ namespace game {
     }
 
 
-    void Light::SetupShader(GLuint program) {
-
-
-        // Set view matrix in shader
-        GLint light = glGetUniformLocation(program, "light_position");
-        glUniform3fv(light, 1, glm::value_ptr(position_));
-
-        GLint color = glGetUniformLocation(program, "light_color");
-        glUniform3fv(color, 1, glm::value_ptr(color_));
-
-    }
-
     void Light::Update(void) {
 
     }
@@ -23,8 +23,6 @@ namespace game {
 
         void Translate(glm::vec3 trans);
 
-        void SetupShader(GLuint program);
-
         void Update(void);
 
     private:
@@ -0,0 +1,228 @@
+#include <iostream>
+#include <cstdio>
+#include <chrono>
+
+#include "logger.h"
+#include "clock.h"
+
+namespace game {
+
+// Messages the ring holds; a power of two, so the sequence wraps cleanly
+#define LOGGER_SLOTS 4096
+// Sleep of the writer thread when the ring is empty, in milliseconds
+#define LOGGER_POLL_INTERVAL 2
+
+std::atomic<int> Logger::level_(InfoLevel);
+std::atomic<bool> Logger::running_(false);
+std::atomic<bool> Logger::quit_(false);
+std::thread Logger::thread_;
+Logger::Slot *Logger::slot_ = NULL;
+std::atomic<unsigned int> Logger::head_(0);
+unsigned int Logger::tail_ = 0;
+std::atomic<unsigned int> Logger::printed_(0);
+std::atomic<int> Logger::dropped_(0);
+
+
+void Logger::Start(void){
+
+    if (running_){
+        return;
+    }
+    if (!slot_){
+        slot_ = new Slot[LOGGER_SLOTS];
+    }
+    for (int i = 0; i < LOGGER_SLOTS; i++){
+        slot_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    head_ = 0;
+    tail_ = 0;
+    printed_ = 0;
+    quit_ = false;
+    running_ = true;
+    thread_ = std::thread(WriterLoop);
+}
+
+
+void Logger::Stop(void){
+
+    if (!running_){
+        return;
+    }
+    quit_ = true;
+    thread_.join();
+    running_ = false;
+    // Messages that came in while the thread was quitting
+    Drain();
+}
+
+
+void Logger::SetLevel(LogLevel level){
+
+    level_ = level;
+}
+
+
+LogLevel Logger::GetLevel(void){
+
+    return (LogLevel) level_.load(std::memory_order_relaxed);
+}
+
+
+bool Logger::IsEnabled(LogLevel level){
+
+    return level >= level_.load(std::memory_order_relaxed);
+}
+
+
+void Logger::Write(LogLevel level, const char *format, ...){
+
+    if (!IsEnabled(level)){
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    Push(level, NULL, 0, format, args);
+    va_end(args);
+}
+
+
+void Logger::Flush(void){
+
+    if (!running_){
+        return;
+    }
+    unsigned int target = head_.load(std::memory_order_acquire);
+    while ((int) (printed_.load(std::memory_order_acquire) - target) < 0){
+        std::this_thread::sleep_for(std::chrono::milliseconds(LOGGER_POLL_INTERVAL));
+    }
+}
+
+
+void Logger::Push(LogLevel level, const char *channel, int suppressed, const char *format, va_list args){
+
+    if (!running_){
+        char text[LOGGER_MESSAGE_SIZE];
+        vsnprintf(text, LOGGER_MESSAGE_SIZE, format, args);
+        Print(level, channel, suppressed, text);
+        return;
+    }
+
+    // Claim the slot at the head once the reader is done with it
+    unsigned int position = head_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true){
+        slot = &slot_[position % LOGGER_SLOTS];
+        int turn = (int) (slot->sequence.load(std::memory_order_acquire) - position);
+        if (turn == 0){
+            if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)){
+                break;
+            }
+        } else if (turn < 0){
+            // A whole ring behind: full
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            position = head_.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->level = level;
+    slot->channel = channel;
+    slot->suppressed = suppressed;
+    vsnprintf(slot->text, LOGGER_MESSAGE_SIZE, format, args);
+    slot->sequence.store(position + 1, std::memory_order_release);
+}
+
+
+void Logger::Print(LogLevel level, const char *channel, int suppressed, const char *text){
+
+    std::ostream &out = (level >= WarningLevel) ? std::cerr : std::cout;
+    if (level == WarningLevel){
+        out << "warning: ";
+    } else if (level == ErrorLevel){
+        out << "error: ";
+    }
+    if (channel){
+        out << channel << ": ";
+    }
+    out << text;
+    if (suppressed > 0){
+        out << " (" << suppressed << " skipped)";
+    }
+    out << "\n";
+}
+
+
+bool Logger::Drain(void){
+
+    bool printed = false;
+    while (true){
+        Slot &slot = slot_[tail_ % LOGGER_SLOTS];
+        if (slot.sequence.load(std::memory_order_acquire) != tail_ + 1){
+            break;
+        }
+        Print(slot.level, slot.channel, slot.suppressed, slot.text);
+        // Hand the slot back to the writers for the next time round
+        slot.sequence.store(tail_ + LOGGER_SLOTS, std::memory_order_release);
+        tail_++;
+        printed_.store(tail_, std::memory_order_release);
+        printed = true;
+    }
+
+    int dropped = dropped_.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0){
+        std::cerr << "warning: " << dropped << " log messages dropped\n";
+        printed = true;
+    }
+    if (printed){
+        std::cout.flush();
+    }
+    return printed;
+}
+
+
+void Logger::WriterLoop(void){
+
+    while (true){
+        // Read the flag first, so nothing written before the quit is left
+        bool quit = quit_;
+        if (!Drain()){
+            if (quit){
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(LOGGER_POLL_INTERVAL));
+        }
+    }
+}
+
+
+LogChannel::LogChannel(const char *name, double interval){
+
+    name_ = name;
+    interval_ = interval;
+    next_ = 0.0;
+    suppressed_ = 0;
+}
+
+
+void LogChannel::Write(LogLevel level, const char *format, ...){
+
+    if (!Logger::IsEnabled(level)){
+        return;
+    }
+
+    // Only the thread that moves the deadline prints
+    double time = Clock::GetWallTime();
+    double next = next_.load(std::memory_order_relaxed);
+    if (time < next || !next_.compare_exchange_strong(next, time + interval_, std::memory_order_relaxed)){
+        suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    Logger::Push(level, name_, suppressed_.exchange(0, std::memory_order_relaxed), format, args);
+    va_end(args);
+}
+
+} // namespace game
@@ -0,0 +1,98 @@
+#ifndef LOGGER_H_
+#define LOGGER_H_
+
+#include <atomic>
+#include <thread>
+#include <cstdarg>
+
+// Longest message, with its terminating null; longer ones are cut
+#define LOGGER_MESSAGE_SIZE 256
+
+namespace game {
+
+    // Importance of a message; messages below the level of the logger are
+    // dropped where they are written
+    typedef enum Level { DebugLevel, InfoLevel, WarningLevel, ErrorLevel } LogLevel;
+
+    // Console output from anywhere in the game, written by a background
+    // thread
+    // Messages are formatted straight into a slot of a fixed ring shared by
+    // all the threads; a writer claims a slot with one compare and swap and
+    // never waits, so printing costs the frame no system call. When the
+    // ring is full, messages are counted and dropped rather than block.
+    // Before Start and after Stop, messages are printed directly
+    class Logger {
+
+        public:
+            // Start and stop the writer thread; Stop prints what is left
+            static void Start(void);
+            static void Stop(void);
+
+            static void SetLevel(LogLevel level);
+            static LogLevel GetLevel(void);
+            static bool IsEnabled(LogLevel level);
+
+            // Queue a message, printf style; a line break is added.
+            // Information goes to the standard output, warnings and errors
+            // to the standard error
+            static void Write(LogLevel level, const char *format, ...);
+
+            // Wait until the messages queued so far are printed, before
+            // printing to the console directly
+            static void Flush(void);
+
+        private:
+            friend class LogChannel;
+
+            // Message in the ring; the sequence tells whose turn the slot
+            // is, the writer's or the reader's
+            struct Slot {
+                std::atomic<unsigned int> sequence;
+                LogLevel level;
+                const char *channel; // NULL outside a channel
+                int suppressed; // Messages of the channel left out before
+                char text[LOGGER_MESSAGE_SIZE];
+            };
+
+            static std::atomic<int> level_;
+            static std::atomic<bool> running_;
+            static std::atomic<bool> quit_;
+            static std::thread thread_;
+            static Slot *slot_;
+            static std::atomic<unsigned int> head_; // Next slot to claim
+            static unsigned int tail_; // Next slot to print
+            static std::atomic<unsigned int> printed_;
+            static std::atomic<int> dropped_;
+
+            static void Push(LogLevel level, const char *channel, int suppressed, const char *format, va_list args);
+            static void Print(LogLevel level, const char *channel, int suppressed, const char *text);
+            // Print every complete message; false if there was none
+            static bool Drain(void);
+            static void WriterLoop(void);
+
+    }; // class Logger
+
+    // Source of messages that can be frequent, printed at most once per
+    // interval
+    // Messages in between are counted and the count is shown with the next
+    // one printed. Safe to share between threads
+    class LogChannel {
+
+        public:
+            // 'name' prefixes the messages and must outlive the channel;
+            // 'interval' is in seconds of wall time
+            LogChannel(const char *name, double interval);
+
+            void Write(LogLevel level, const char *format, ...);
+
+        private:
+            const char *name_;
+            double interval_;
+            std::atomic<double> next_; // Earliest time of the next message
+            std::atomic<int> suppressed_;
+
+    }; // class LogChannel
+
+} // namespace game
+
+#endif // LOGGER_H_
@@ -10,16 +10,103 @@
 
 #include <iostream>
 #include <exception>
+#include <string>
+#include <cstdlib>
 #include "game.h"
+#include "profiler.h"
+#include "logger.h"
 
 // Macro for printing exceptions
 #define PrintException(exception_object)\
 	std::cerr << exception_object.what() << std::endl
 
+// Length of an offscreen run when neither frames nor seconds are given
+#define HEADLESS_DEFAULT_FRAMES 300
+
 // Main function that builds and runs the game
-int main(void){
+// Options: --headless renders offscreen without a window, for --frames N
+// frames or --seconds S seconds, --capture FILE saves the last frame and
+// --compare FILE compares it with an earlier capture; --no-bake keeps the
+// static level pieces apart instead of merging them;
+// --profile FILE times the frame and writes a Chrome trace at the end;
+// --benchmark PATH walks a path recorded with --record PATH and reports
+// frame statistics as JSON, to --report FILE or the standard output;
+// --log-level debug|info|warning|error hides the messages below the level
+int main(int argc, char *argv[]){
     game::Game app; // Game application
 
+    bool headless = false;
+    int frames = 0;
+    double seconds = 0.0;
+    std::string capture;
+    std::string compare;
+    bool bake = true;
+    std::string trace;
+    std::string benchmark;
+    std::string report;
+    std::string record;
+    std::string log_level;
+    for (int i = 1; i < argc; i++){
+        std::string option = argv[i];
+        bool has_value = (i + 1 < argc);
+        if (option == "--headless"){
+            headless = true;
+        } else if (option == "--frames" && has_value){
+            frames = atoi(argv[++i]);
+        } else if (option == "--seconds" && has_value){
+            seconds = atof(argv[++i]);
+        } else if (option == "--capture" && has_value){
+            capture = argv[++i];
+        } else if (option == "--compare" && has_value){
+            compare = argv[++i];
+        } else if (option == "--no-bake"){
+            bake = false;
+        } else if (option == "--profile" && has_value){
+            trace = argv[++i];
+        } else if (option == "--benchmark" && has_value){
+            benchmark = argv[++i];
+        } else if (option == "--report" && has_value){
+            report = argv[++i];
+        } else if (option == "--record" && has_value){
+            record = argv[++i];
+        } else if (option == "--log-level" && has_value){
+            log_level = argv[++i];
+            if (log_level == "debug"){
+                game::Logger::SetLevel(game::DebugLevel);
+            } else if (log_level == "info"){
+                game::Logger::SetLevel(game::InfoLevel);
+            } else if (log_level == "warning"){
+                game::Logger::SetLevel(game::WarningLevel);
+            } else if (log_level == "error"){
+                game::Logger::SetLevel(game::ErrorLevel);
+            } else {
+                std::cerr << "Unknown log level " << log_level << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--headless [--frames N | --seconds S] [--capture FILE] [--compare FILE]] [--no-bake] [--profile FILE] [--benchmark PATH [--report FILE]] [--record PATH] [--log-level LEVEL]" << std::endl;
+            return 1;
+        }
+    }
+    if (!benchmark.empty()){
+        app.SetBenchmark(benchmark, report);
+    }
+    if (!record.empty()){
+        app.SetRecording(record);
+    }
+    if (headless){
+        if (frames <= 0 && seconds <= 0.0){
+            frames = HEADLESS_DEFAULT_FRAMES;
+        }
+        app.SetHeadless(frames, seconds, capture);
+        if (!compare.empty()){
+            app.SetComparison(compare);
+        }
+    }
+    app.SetBaking(bake);
+    game::Profiler::SetEnabled(!trace.empty());
+    game::Logger::Start();
+
     try {
         // Initialize game
         app.Init();
@@ -28,10 +115,16 @@ int main(void){
         app.SetupScene();
         // Run game
         app.MainLoop();
+        if (!trace.empty()){
+            game::Profiler::PrintSummary();
+            game::Profiler::WriteTrace(trace);
+        }
     }
     catch (std::exception &e){
+        game::Logger::Flush();
         PrintException(e);
     }
+    game::Logger::Stop();
 
     return 0;
 }
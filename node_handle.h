@@ -0,0 +1,26 @@
+#ifndef NODE_HANDLE_H_
+#define NODE_HANDLE_H_
+
+namespace game {
+
+    // Stable reference to a node in the scene graph
+    // The index selects a slot of the handle table and the generation tells
+    // apart nodes that reused the same slot. A handle with generation zero
+    // never refers to a node
+    struct NodeHandle {
+
+        unsigned int index;
+        unsigned int generation;
+
+        NodeHandle(void) : index(0), generation(0) {}
+        NodeHandle(unsigned int i, unsigned int g) : index(i), generation(g) {}
+
+        bool IsNull(void) const { return generation == 0; }
+        bool operator==(const NodeHandle &other) const { return index == other.index && generation == other.generation; }
+        bool operator!=(const NodeHandle &other) const { return !(*this == other); }
+
+    }; // struct NodeHandle
+
+} // namespace game
+
+#endif // NODE_HANDLE_H_
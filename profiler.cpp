@@ -0,0 +1,258 @@
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+
+#include "profiler.h"
+#include "clock.h"
+#include "logger.h"
+
+namespace game {
+
+// Most zones kept for the trace; later zones only go to the summary
+#define PROFILER_MAX_EVENTS (1 << 20)
+// Durations per zone in the summary
+#define PROFILER_HISTORY 240
+// Frames before the query of a GPU zone is read
+#define PROFILER_GPU_LATENCY 3
+// Zones a thread can finish between two frames; more are dropped
+#define PROFILER_THREAD_EVENTS 4096
+
+bool Profiler::enabled_ = false;
+std::atomic<Profiler::ThreadEvents *> Profiler::thread_events_[PROFILER_MAX_THREADS];
+std::vector<Profiler::Event> Profiler::event_;
+std::map<const char *, Profiler::History> Profiler::history_;
+std::map<const char *, Profiler::History> Profiler::gpu_history_;
+int Profiler::gpu_timing_ = -1;
+bool Profiler::gpu_open_ = false;
+int Profiler::frame_ = 0;
+std::deque<Profiler::GpuZone> Profiler::pending_;
+std::vector<GLuint> Profiler::free_query_;
+
+// Index of the next thread that records a zone; zero is the GPU
+static std::atomic<int> next_thread_g(1);
+
+
+void Profiler::SetEnabled(bool enabled){
+
+    enabled_ = enabled;
+}
+
+
+bool Profiler::IsEnabled(void){
+
+    return enabled_;
+}
+
+
+int Profiler::GetThreadIndex(void){
+
+    static thread_local int index = next_thread_g++;
+    return index;
+}
+
+
+void Profiler::Add(const char *name, double start, double duration, int thread){
+
+    if (thread >= PROFILER_MAX_THREADS){
+        return;
+    }
+    ThreadEvents *events = thread_events_[thread].load(std::memory_order_acquire);
+    if (!events){
+        events = new ThreadEvents();
+        events->event.resize(PROFILER_THREAD_EVENTS);
+        events->head = 0;
+        events->tail = 0;
+        thread_events_[thread].store(events, std::memory_order_release);
+    }
+
+    // Only this thread moves the head; a full ring drops the zone
+    unsigned int head = events->head.load(std::memory_order_relaxed);
+    if (head - events->tail.load(std::memory_order_acquire) == PROFILER_THREAD_EVENTS){
+        return;
+    }
+    Event &event = events->event[head % PROFILER_THREAD_EVENTS];
+    event.name = name;
+    event.start = start;
+    event.duration = duration;
+    event.thread = thread;
+    events->head.store(head + 1, std::memory_order_release);
+}
+
+
+void Profiler::Collect(void){
+
+    for (int i = 0; i < PROFILER_MAX_THREADS; i++){
+        ThreadEvents *events = thread_events_[i].load(std::memory_order_acquire);
+        if (!events){
+            continue;
+        }
+        unsigned int tail = events->tail.load(std::memory_order_relaxed);
+        unsigned int head = events->head.load(std::memory_order_acquire);
+        for (; tail != head; tail++){
+            const Event &event = events->event[tail % PROFILER_THREAD_EVENTS];
+            if (event_.size() < PROFILER_MAX_EVENTS){
+                event_.push_back(event);
+            }
+
+            History &history = (event.thread == 0) ? gpu_history_[event.name] : history_[event.name];
+            if (history.duration.size() < PROFILER_HISTORY){
+                history.duration.push_back(event.duration);
+                history.next = 0;
+            } else {
+                history.duration[history.next] = event.duration;
+                history.next = (history.next + 1) % PROFILER_HISTORY;
+            }
+        }
+        // The slots read can be written again
+        events->tail.store(tail, std::memory_order_release);
+    }
+}
+
+
+bool Profiler::BeginGpu(const char *name, double start){
+
+    if (gpu_timing_ == -1){
+        gpu_timing_ = (GLEW_VERSION_3_3 || GLEW_ARB_timer_query) ? 1 : 0;
+    }
+    // Elapsed time queries cannot nest
+    if (!gpu_timing_ || gpu_open_){
+        return false;
+    }
+
+    GpuZone zone;
+    if (free_query_.size() > 0){
+        zone.query = free_query_.back();
+        free_query_.pop_back();
+    } else {
+        glGenQueries(1, &zone.query);
+    }
+    zone.name = name;
+    zone.start = start;
+    zone.frame = frame_;
+    pending_.push_back(zone);
+
+    glBeginQuery(GL_TIME_ELAPSED, zone.query);
+    gpu_open_ = true;
+    return true;
+}
+
+
+void Profiler::EndGpu(void){
+
+    glEndQuery(GL_TIME_ELAPSED);
+    gpu_open_ = false;
+}
+
+
+void Profiler::EndFrame(void){
+
+    frame_++;
+
+    // Queries finish in order; stop at the first one that is not ready
+    // rather than wait for it. The GPU has no clock of the CPU, so a zone
+    // is placed where the CPU issued it
+    while (pending_.size() > 0 && pending_.front().frame <= frame_ - PROFILER_GPU_LATENCY){
+        GpuZone &zone = pending_.front();
+        GLint available = 0;
+        glGetQueryObjectiv(zone.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available){
+            break;
+        }
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(zone.query, GL_QUERY_RESULT, &elapsed);
+        Add(zone.name, zone.start, elapsed * 1e-9, 0);
+        free_query_.push_back(zone.query);
+        pending_.pop_front();
+    }
+
+    Collect();
+}
+
+
+void Profiler::WriteTrace(std::string filename){
+
+    Collect();
+
+    std::ofstream f(filename.c_str());
+    if (f.fail()){
+        throw(std::ios_base::failure(std::string("Error opening file ")+filename));
+    }
+
+    // Complete events in microseconds, and a name for every thread
+    f << std::fixed << std::setprecision(3);
+    f << "{\"traceEvents\":[\n";
+    int num_threads = 0;
+    for (int i = 0; i < event_.size(); i++){
+        const Event &event = event_[i];
+        f << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread << ",\"ts\":" << event.start * 1e6 << ",\"dur\":" << event.duration * 1e6 << "},\n";
+        num_threads = std::max(num_threads, event.thread + 1);
+    }
+    for (int i = 0; i < num_threads; i++){
+        f << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i << ",\"args\":{\"name\":\"";
+        if (i == 0){
+            f << "GPU";
+        } else {
+            f << "CPU " << i;
+        }
+        f << "\"}}" << (i + 1 < num_threads ? ",\n" : "\n");
+    }
+    f << "],\"displayTimeUnit\":\"ms\"}\n";
+    f.close();
+}
+
+
+void Profiler::PrintSummary(void){
+
+    Collect();
+
+    // The same literal can have an address in every file that uses it,
+    // so histories are joined by name for printing
+    std::map<std::string, std::vector<double> > duration;
+    for (std::map<const char *, History>::const_iterator it = history_.begin(); it != history_.end(); it++){
+        std::vector<double> &sorted = duration[it->first];
+        sorted.insert(sorted.end(), it->second.duration.begin(), it->second.duration.end());
+    }
+    for (std::map<const char *, History>::const_iterator it = gpu_history_.begin(); it != gpu_history_.end(); it++){
+        std::vector<double> &sorted = duration[std::string("GPU ") + it->first];
+        sorted.insert(sorted.end(), it->second.duration.begin(), it->second.duration.end());
+    }
+
+    for (std::map<std::string, std::vector<double> >::iterator it = duration.begin(); it != duration.end(); it++){
+        std::vector<double> &sorted = it->second;
+        std::sort(sorted.begin(), sorted.end());
+        int n = sorted.size();
+        // Nearest rank
+        double p50 = sorted[std::max(0, (n * 50 + 99) / 100 - 1)];
+        double p95 = sorted[std::max(0, (n * 95 + 99) / 100 - 1)];
+        double p99 = sorted[std::max(0, (n * 99 + 99) / 100 - 1)];
+        Logger::Write(InfoLevel, "%s: p50 %.3f ms, p95 %.3f ms, p99 %.3f ms (%d samples)", it->first.c_str(), p50 * 1000.0, p95 * 1000.0, p99 * 1000.0, n);
+    }
+}
+
+
+ProfileZone::ProfileZone(const char *name, bool gpu){
+
+    if (!Profiler::enabled_){
+        start_ = -1.0;
+        return;
+    }
+    name_ = name;
+    start_ = Clock::GetWallTime();
+    gpu_ = gpu && Profiler::BeginGpu(name, start_);
+}
+
+
+ProfileZone::~ProfileZone(){
+
+    if (start_ < 0.0){
+        return;
+    }
+    if (gpu_){
+        Profiler::EndGpu();
+    }
+    Profiler::Add(name_, start_, Clock::GetWallTime() - start_, Profiler::GetThreadIndex());
+}
+
+} // namespace game
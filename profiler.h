@@ -0,0 +1,126 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <atomic>
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+// Most threads that can record zones; zones of later threads are dropped
+#define PROFILER_MAX_THREADS 64
+
+namespace game {
+
+    // Timing of named zones of the frame, on the CPU and on the GPU
+    // A zone is timed from the construction of a ProfileZone to its
+    // destruction; zones nest by time, and can be opened on any thread.
+    // Each thread writes its finished zones to a ring of its own, without
+    // locks, and EndFrame moves them to the trace and the summary.
+    // GPU zones time the commands issued in them with GL_TIME_ELAPSED
+    // queries, which are read back a few frames later, when the GPU is
+    // done, so reading never stalls. Zones are kept as Chrome trace
+    // events, and the last durations of each name give a running
+    // percentile summary
+    // When disabled, a zone costs one test of a flag
+    class Profiler {
+
+        public:
+            static void SetEnabled(bool enabled);
+            static bool IsEnabled(void);
+
+            // Collect the zones finished on every thread and the GPU zones
+            // that are ready; call once per frame, after the frame was
+            // submitted, on the GL thread
+            static void EndFrame(void);
+
+            // Write the zones recorded so far as a Chrome trace
+            // (chrome://tracing, Perfetto); on the thread of EndFrame
+            static void WriteTrace(std::string filename);
+            // Log the median, 95th and 99th percentile of the recent
+            // durations of each zone; on the thread of EndFrame
+            static void PrintSummary(void);
+
+        private:
+            friend class ProfileZone;
+
+            // Zone of the trace; 'thread' is zero for the GPU
+            struct Event {
+                const char *name;
+                double start; // Wall time in seconds
+                double duration;
+                int thread;
+            };
+
+            // GPU zone waiting for its query
+            struct GpuZone {
+                GLuint query;
+                const char *name;
+                double start;
+                int frame;
+            };
+
+            // Zones finished on one thread and not collected yet; the
+            // thread moves the head, EndFrame the tail
+            struct ThreadEvents {
+                std::vector<Event> event;
+                std::atomic<unsigned int> head;
+                std::atomic<unsigned int> tail;
+            };
+
+            // Recent durations of a zone, oldest overwritten first
+            struct History {
+                std::vector<double> duration;
+                int next;
+            };
+
+            static bool enabled_;
+            // Rings by thread index, created by their thread on its first
+            // zone
+            static std::atomic<ThreadEvents *> thread_events_[PROFILER_MAX_THREADS];
+            static std::vector<Event> event_;
+            // Keyed by the name of the zone, which is a string literal;
+            // the GPU zones apart from the CPU zones of the same name
+            static std::map<const char *, History> history_;
+            static std::map<const char *, History> gpu_history_;
+
+            // GPU zones; support is checked on the first one
+            static int gpu_timing_;
+            static bool gpu_open_;
+            static int frame_;
+            static std::deque<GpuZone> pending_;
+            static std::vector<GLuint> free_query_;
+
+            // Record a finished zone in the ring of 'thread', which must be
+            // the calling thread, or zero on the GL thread
+            static void Add(const char *name, double start, double duration, int thread);
+            // Move the zones of the rings to the trace and the histories
+            static void Collect(void);
+            static int GetThreadIndex(void);
+            static bool BeginGpu(const char *name, double start);
+            static void EndGpu(void);
+
+    }; // class Profiler
+
+    // Scope timed by the profiler
+    // 'name' must outlive the profiler, as string literals do. With 'gpu',
+    // the GPU time of the commands issued in the scope is measured too;
+    // GPU zones must not nest, and need the GL thread
+    class ProfileZone {
+
+        public:
+            ProfileZone(const char *name, bool gpu = false);
+            ~ProfileZone();
+
+        private:
+            const char *name_;
+            double start_; // Negative when the profiler was disabled
+            bool gpu_;
+
+    }; // class ProfileZone
+
+} // namespace game
+
+#endif // PROFILER_H_
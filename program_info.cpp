@@ -0,0 +1,114 @@
+#include <stdexcept>
+
+#include "program_info.h"
+
+namespace game {
+
+// Names of the inputs with a slot, in enum order
+static const char *uniform_names[NumUniforms] = { "world_mat", "normal_mat", "texture_map", "position", "frustum_planes", "num_nodes" };
+static const char *attribute_names[NumAttributes] = { "vertex", "normal", "color", "uv", "position", "particle_property", "lifespan", "instance_world_mat", "instance_normal_mat", "instance_position" };
+
+std::vector<ProgramInfo *> ProgramInfo::registry_;
+
+
+// Strip the "[0]" that arrays get in their active name
+static std::string BaseName(const char *name){
+
+    std::string base(name);
+    size_t bracket = base.find('[');
+    if (bracket != std::string::npos){
+        base.erase(bracket);
+    }
+    return base;
+}
+
+
+ProgramInfo::ProgramInfo(GLuint program){
+
+    program_ = program;
+    for (int i = 0; i < NumUniforms; i++){
+        uniform_[i] = -1;
+    }
+    for (int i = 0; i < NumAttributes; i++){
+        attribute_[i] = -1;
+    }
+
+    char name[256];
+    GLint size;
+    GLenum type;
+
+    // Uniforms
+    GLint count = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    for (GLint i = 0; i < count; i++){
+        glGetActiveUniform(program, i, sizeof(name), NULL, &size, &type, name);
+        GLint location = glGetUniformLocation(program, name);
+        if (location < 0){
+            // Members of uniform blocks have no location
+            continue;
+        }
+        std::string base = BaseName(name);
+        for (int u = 0; u < NumUniforms; u++){
+            if (base == uniform_names[u]){
+                uniform_[u] = location;
+            }
+        }
+    }
+
+    // Attributes
+    count = 0;
+    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+    for (GLint i = 0; i < count; i++){
+        glGetActiveAttrib(program, i, sizeof(name), NULL, &size, &type, name);
+        GLint location = glGetAttribLocation(program, name);
+        if (location < 0){
+            // Built-in inputs such as gl_VertexID
+            continue;
+        }
+        std::string base = BaseName(name);
+        for (int a = 0; a < NumAttributes; a++){
+            if (base == attribute_names[a]){
+                attribute_[a] = location;
+            }
+        }
+    }
+}
+
+
+GLuint ProgramInfo::GetProgram(void) const {
+
+    return program_;
+}
+
+
+GLint ProgramInfo::GetUniform(ProgramUniform uniform) const {
+
+    return uniform_[uniform];
+}
+
+
+GLint ProgramInfo::GetAttribute(ProgramAttribute attribute) const {
+
+    return attribute_[attribute];
+}
+
+
+void ProgramInfo::Register(GLuint program){
+
+    if (program >= registry_.size()){
+        registry_.resize(program + 1, NULL);
+    }
+    delete registry_[program];
+    registry_[program] = new ProgramInfo(program);
+}
+
+
+const ProgramInfo &ProgramInfo::Get(GLuint program){
+
+    if (program >= registry_.size() || !registry_[program]){
+        throw(std::invalid_argument(std::string("Shader program was not loaded through the resource manager")));
+    }
+    return *registry_[program];
+}
+
+} // namespace game
@@ -0,0 +1,51 @@
+#ifndef PROGRAM_INFO_H_
+#define PROGRAM_INFO_H_
+
+#include <string>
+#include <vector>
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+namespace game {
+
+    // Uniforms set by the engine
+    // The camera, light and time come from the frame constants block; the
+    // frustum planes and node count are inputs of the culling program
+    typedef enum Uniform { WorldMatUniform, NormalMatUniform, TextureMapUniform, PositionUniform, FrustumPlanesUniform, NodeCountUniform, NumUniforms } ProgramUniform;
+    // Vertex attributes fed by the engine
+    typedef enum Attribute { VertexAttribute, NormalAttribute, ColorAttribute, UvAttribute, PositionAttribute, ParticlePropertyAttribute, LifespanAttribute, InstanceWorldMatAttribute, InstanceNormalMatAttribute, InstancePositionAttribute, NumAttributes } ProgramAttribute;
+
+    // Active uniforms and attributes of a linked shader program
+    // The program is queried once when it is loaded; the draw path then
+    // reads locations from a fixed table instead of looking names up
+    // every frame. Missing inputs have location -1, which glUniform*
+    // ignores
+    class ProgramInfo {
+
+        public:
+            // Enumerate the inputs of a linked program
+            ProgramInfo(GLuint program);
+
+            GLuint GetProgram(void) const;
+            GLint GetUniform(ProgramUniform uniform) const;
+            GLint GetAttribute(ProgramAttribute attribute) const;
+
+            // Reflect a program and keep its table; programs live as long
+            // as the game
+            static void Register(GLuint program);
+            // Table of a registered program
+            static const ProgramInfo &Get(GLuint program);
+
+        private:
+            GLuint program_;
+            GLint uniform_[NumUniforms];
+            GLint attribute_[NumAttributes];
+
+            // Tables indexed by program handle; handles are small integers
+            static std::vector<ProgramInfo *> registry_;
+
+    }; // class ProgramInfo
+
+} // namespace game
+
+#endif // PROGRAM_INFO_H_
@@ -9,15 +9,23 @@ Resource::Resource(ResourceType type, std::string name, GLuint resource, GLsizei
     name_ = name;
     resource_ = resource;
     size_ = size;
+    bound_radius_ = 0.0;
+    instanced_resource_ = 0;
+    mergeable_ = false;
+    users_ = 0;
 }
 
 
-Resource::Resource(ResourceType type, std::string name, GLuint array_buffer, GLuint element_array_buffer, GLsizei size){
+Resource::Resource(ResourceType type, std::string name, GeometryArena *arena, int geometry, GLsizei size){
     type_ = type;
     name_ = name;
-    array_buffer_ = array_buffer;
-    element_array_buffer_ = element_array_buffer;
+    arena_ = arena;
+    geometry_ = geometry;
     size_ = size;
+    bound_radius_ = 0.0;
+    instanced_resource_ = 0;
+    mergeable_ = false;
+    users_ = 0;
 }
 
 
@@ -46,13 +54,55 @@ GLuint Resource::GetResource(void) const {
 
 GLuint Resource::GetArrayBuffer(void) const {
 
-    return array_buffer_;
+    return arena_->GetArrayBuffer(geometry_);
 }
 
 
 GLuint Resource::GetElementArrayBuffer(void) const {
 
-    return element_array_buffer_;
+    return arena_->GetElementArrayBuffer();
+}
+
+
+GLint Resource::GetBaseVertex(void) const {
+
+    return arena_->GetBaseVertex(geometry_);
+}
+
+
+GLuint Resource::GetFirstIndex(void) const {
+
+    return arena_->GetFirstIndex(geometry_);
+}
+
+
+int Resource::GetArenaVersion(void) const {
+
+    return arena_->GetVersion();
+}
+
+
+int Resource::GetGeometryIndex(void) const {
+
+    return geometry_;
+}
+
+
+int Resource::GetUsers(void) const {
+
+    return users_.load();
+}
+
+
+void Resource::AddUser(void) const {
+
+    users_.fetch_add(1);
+}
+
+
+void Resource::RemoveUser(void) const {
+
+    users_.fetch_sub(1);
 }
 
 
@@ -61,4 +111,52 @@ GLsizei Resource::GetSize(void) const {
     return size_;
 }
 
+
+float Resource::GetBoundRadius(void) const {
+
+    return bound_radius_;
+}
+
+
+void Resource::SetBoundRadius(float radius){
+
+    bound_radius_ = radius;
+}
+
+
+GLuint Resource::GetInstancedResource(void) const {
+
+    return instanced_resource_;
+}
+
+
+void Resource::SetInstancedResource(GLuint resource){
+
+    instanced_resource_ = resource;
+}
+
+
+bool Resource::GetMergeable(void) const {
+
+    return mergeable_;
+}
+
+
+void Resource::SetMergeable(bool mergeable){
+
+    mergeable_ = mergeable;
+}
+
+
+int Resource::GetVertexSize(void) const {
+
+    return arena_->GetVertexSize(geometry_);
+}
+
+
+GLuint Resource::GetVertexArray(GLuint program) const {
+
+    return arena_->GetVertexArray(geometry_, program);
+}
+
 } // namespace game
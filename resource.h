@@ -2,10 +2,13 @@
 #define RESOURCE_H_
 
 #include <string>
+#include <atomic>
 #define GLEW_STATIC
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include "geometry_arena.h"
+
 namespace game {
 
     // Possible resource types
@@ -22,22 +25,61 @@ namespace game {
                     GLuint resource_; // OpenGL handle for resource
                 };
                 struct {
-                    GLuint array_buffer_; // Buffers for geometry
-                    GLuint element_array_buffer_;
+                    GeometryArena *arena_; // Arena holding the geometry
+                    int geometry_; // Geometry in the arena
                 };
             };
             GLsizei size_; // Number of primitives in geometry
+            float bound_radius_; // Radius of a sphere around the origin that holds the geometry
+            GLuint instanced_resource_; // Variant of a shader program for instanced drawing
+            bool mergeable_; // Material looks the same on merged geometry
+            mutable std::atomic<int> users_; // Scene nodes drawing the geometry
 
         public:
             Resource(ResourceType type, std::string name, GLuint resource, GLsizei size);
-            Resource(ResourceType type, std::string name, GLuint array_buffer, GLuint element_array_buffer, GLsizei size);
+            Resource(ResourceType type, std::string name, GeometryArena *arena, int geometry, GLsizei size);
             ~Resource();
             ResourceType GetType(void) const;
             const std::string GetName(void) const;
             GLuint GetResource(void) const;
+            // Shared buffers holding the geometry, and where it starts in
+            // them; the start changes when the arena is compacted
             GLuint GetArrayBuffer(void) const;
             GLuint GetElementArrayBuffer(void) const;
+            GLint GetBaseVertex(void) const;
+            GLuint GetFirstIndex(void) const;
+            // Version of the arena; a start read under another version
+            // is stale
+            int GetArenaVersion(void) const;
+            // Index of the geometry in the arena
+            int GetGeometryIndex(void) const;
             GLsizei GetSize(void) const;
+            // Number of scene nodes drawing the geometry; the nodes count
+            // themselves in and out, and geometry in use is not removed
+            int GetUsers(void) const;
+            void AddUser(void) const;
+            void RemoveUser(void) const;
+            // Bounding sphere of the geometry in object space; zero when
+            // the extent is unknown
+            float GetBoundRadius(void) const;
+            void SetBoundRadius(float radius);
+            // Variant of a material that takes the world matrix and the
+            // other per-node inputs as instance attributes; zero if the
+            // material has none
+            GLuint GetInstancedResource(void) const;
+            void SetInstancedResource(GLuint resource);
+            // Whether nodes drawn with a material can be merged into one
+            // mesh in world space: its lighting must not depend on the
+            // world matrix or position of the node; false by default
+            bool GetMergeable(void) const;
+            void SetMergeable(bool mergeable);
+            // Number of floats per vertex of the geometry: 11 for position,
+            // normal, color and texture coordinates, 15 when particle
+            // properties and lifespan follow
+            int GetVertexSize(void) const;
+            // Vertex array object that feeds the geometry to a shader
+            // program; shared by all geometry with the same vertex size
+            GLuint GetVertexArray(GLuint program) const;
 
     }; // class Resource
 
@@ -1,13 +1,17 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/constants.hpp>
 #include <stdexcept>
+#include <cstdlib>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
 #include <SOIL/SOIL.h>
 
 #include "resource_manager.h"
 #include "model_loader.h"
+#include "program_info.h"
+#include "frame_constants.h"
 
 namespace game {
 
@@ -29,16 +33,49 @@ void ResourceManager::AddResource(ResourceType type, const std::string name, GLu
 }
 
 
-void ResourceManager::AddResource(ResourceType type, const std::string name, GLuint array_buffer, GLuint element_array_buffer, GLsizei size){
+void ResourceManager::AddResource(ResourceType type, const std::string name, const GLfloat *vertex, int num_vertices, int vertex_size, const GLuint *index, int num_indices, float bound_radius){
 
     Resource *res;
 
-    res = new Resource(type, name, array_buffer, element_array_buffer, size);
+    // Meshes are drawn through their indices, point sets through their
+    // vertices
+    int geometry = arena_.Add(vertex, num_vertices, vertex_size, index, num_indices);
+    res = new Resource(type, name, &arena_, geometry, (type == PointSet) ? num_vertices : num_indices);
+    res->SetBoundRadius(bound_radius);
 
     resource_.push_back(res);
 }
 
 
+void ResourceManager::RemoveResource(const std::string name){
+
+    for (int i = 0; i < resource_.size(); i++){
+        if (resource_[i]->GetName() == name){
+            Resource *res = resource_[i];
+            // Nodes, the draw queue and the indirect commands point at
+            // the geometry
+            if (res->GetUsers() > 0){
+                throw(std::invalid_argument(std::string("Resource still in use: ") + name));
+            }
+            if (res->GetType() == Mesh || res->GetType() == PointSet){
+                arena_.Remove(res->GetGeometryIndex());
+            } else if (res->GetType() == Material){
+                glDeleteProgram(res->GetResource());
+                if (res->GetInstancedResource()){
+                    glDeleteProgram(res->GetInstancedResource());
+                }
+            } else if (res->GetType() == Texture){
+                GLuint texture = res->GetResource();
+                glDeleteTextures(1, &texture);
+            }
+            resource_.erase(resource_.begin() + i);
+            delete res;
+            return;
+        }
+    }
+}
+
+
 void ResourceManager::LoadResource(ResourceType type, const std::string name, const char *filename){
 
     // Call appropriate method depending on type of resource
@@ -66,6 +103,27 @@ Resource *ResourceManager::GetResource(const std::string name) const {
 }
 
 
+Resource *ResourceManager::GetResource(ResourceType type, GLuint handle) const {
+
+    // Find resource with the specified handle
+    for (int i = 0; i < resource_.size(); i++){
+        if (resource_[i]->GetType() == type && resource_[i]->GetResource() == handle){
+            return resource_[i];
+        }
+    }
+    return NULL;
+}
+
+
+void ResourceManager::LoadComputeProgram(const std::string name, const char *prefix) {
+
+    // A compute program is not combined with the other stages
+    std::string filename = std::string(prefix) + std::string(COMPUTE_PROGRAM_EXTENSION);
+    std::string cp = LoadTextFile(filename.c_str());
+    AddResource(Material, name, CreateComputeProgram(cp), 0);
+}
+
+
 void ResourceManager::LoadMaterial(const std::string name, const char* prefix) {
 
     // Load vertex program source code
@@ -76,9 +134,36 @@ void ResourceManager::LoadMaterial(const std::string name, const char* prefix) {
     filename = std::string(prefix) + std::string(FRAGMENT_PROGRAM_EXTENSION);
     std::string fp = LoadTextFile(filename.c_str());
 
+    // Try to also load a geometry shader
+    filename = std::string(prefix) + std::string(GEOMETRY_PROGRAM_EXTENSION);
+    std::string gp = "";
+    try {
+        gp = LoadTextFile(filename.c_str());
+    }
+    catch (std::exception& e) {
+    }
+
+    GLuint sp = CreateProgram(vp, fp, gp);
+
+    // Add a resource for the shader program
+    AddResource(Material, name, sp, 0);
+
+    // Vertex programs that read their per-node inputs from instance
+    // attributes when INSTANCED is defined get a second program for
+    // instanced drawing
+    if (vp.find(INSTANCED_PROGRAM_DEFINE) != std::string::npos) {
+        std::string instanced_vp = InsertAfterVersion(vp, std::string("#define ") + INSTANCED_PROGRAM_DEFINE + "\n");
+        resource_.back()->SetInstancedResource(CreateProgram(instanced_vp, fp, gp));
+    }
+}
+
+
+GLuint ResourceManager::CreateProgram(const std::string &vp, const std::string &fp, const std::string &gp) {
+
     // Create a shader from the vertex program source code
     GLuint vs = glCreateShader(GL_VERTEX_SHADER);
-    const char* source_vp = vp.c_str();
+    std::string full_vp = AddFrameConstants(vp);
+    const char* source_vp = full_vp.c_str();
     glShaderSource(vs, 1, &source_vp, NULL);
     glCompileShader(vs);
 
@@ -93,7 +178,8 @@ void ResourceManager::LoadMaterial(const std::string name, const char* prefix) {
 
     // Create a shader from the fragment program source code
     GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
-    const char* source_fp = fp.c_str();
+    std::string full_fp = AddFrameConstants(fp);
+    const char* source_fp = full_fp.c_str();
     glShaderSource(fs, 1, &source_fp, NULL);
     glCompileShader(fs);
 
@@ -105,22 +191,14 @@ void ResourceManager::LoadMaterial(const std::string name, const char* prefix) {
         throw(std::ios_base::failure(std::string("Error compiling fragment shader: ") + std::string(buffer)));
     }
 
-    // Try to also load a geometry shader
-    filename = std::string(prefix) + std::string(GEOMETRY_PROGRAM_EXTENSION);
-    bool geometry_program = false;
-    std::string gp = "";
+    // Geometry shader, if there is one
+    bool geometry_program = (gp.size() > 0);
     GLuint gs;
-    try {
-        gp = LoadTextFile(filename.c_str());
-        geometry_program = true;
-    }
-    catch (std::exception& e) {
-    }
-
     if (geometry_program) {
         // Create a shader from the geometry program source code
         gs = glCreateShader(GL_GEOMETRY_SHADER);
-        const char* source_gp = gp.c_str();
+        std::string full_gp = AddFrameConstants(gp);
+        const char* source_gp = full_gp.c_str();
         glShaderSource(gs, 1, &source_gp, NULL);
         glCompileShader(gs);
 
@@ -160,8 +238,80 @@ void ResourceManager::LoadMaterial(const std::string name, const char* prefix) {
         glDeleteShader(gs);
     }
 
-    // Add a resource for the shader program
-    AddResource(Material, name, sp, 0);
+    // Attach the frame constants block, if the program reads it
+    GLuint block = glGetUniformBlockIndex(sp, FRAME_CONSTANTS_BLOCK);
+    if (block != GL_INVALID_INDEX) {
+        glUniformBlockBinding(sp, block, FRAME_CONSTANTS_BINDING);
+    }
+
+    // Enumerate the inputs of the program once, for the draw path
+    ProgramInfo::Register(sp);
+
+    return sp;
+}
+
+
+std::string ResourceManager::InsertAfterVersion(const std::string &source, const std::string &lines) {
+
+    std::string result = source;
+    size_t version = source.find("#version");
+    size_t line_end = (version != std::string::npos) ? source.find('\n', version) : std::string::npos;
+    if (line_end == std::string::npos) {
+        result.insert(0, lines);
+    } else {
+        result.insert(line_end + 1, lines);
+    }
+    return result;
+}
+
+
+std::string ResourceManager::AddFrameConstants(const std::string &source) {
+
+    std::string lines = FRAME_CONSTANTS_SOURCE;
+    size_t version = source.find("#version");
+    if (version == std::string::npos || atoi(source.c_str() + version + 8) < FRAME_CONSTANTS_CORE_VERSION) {
+        lines = FRAME_CONSTANTS_EXTENSION + lines;
+    }
+    return InsertAfterVersion(source, lines);
+}
+
+
+GLuint ResourceManager::CreateComputeProgram(const std::string &cp) {
+
+    // Create a shader from the compute program source code
+    GLuint cs = glCreateShader(GL_COMPUTE_SHADER);
+    const char* source_cp = cp.c_str();
+    glShaderSource(cs, 1, &source_cp, NULL);
+    glCompileShader(cs);
+
+    // Check if shader compiled successfully
+    GLint status;
+    glGetShaderiv(cs, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+        char buffer[512];
+        glGetShaderInfoLog(cs, 512, NULL, buffer);
+        throw(std::ios_base::failure(std::string("Error compiling compute shader: ") + std::string(buffer)));
+    }
+
+    // Create a shader program with the compute shader alone
+    GLuint sp = glCreateProgram();
+    glAttachShader(sp, cs);
+    glLinkProgram(sp);
+
+    // Check if the shader was linked successfully
+    glGetProgramiv(sp, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        char buffer[512];
+        glGetProgramInfoLog(sp, 512, NULL, buffer);
+        throw(std::ios_base::failure(std::string("Error linking compute shader: ") + std::string(buffer)));
+    }
+
+    glDeleteShader(cs);
+
+    // Enumerate the inputs of the program once, for the draw path
+    ProgramInfo::Register(sp);
+
+    return sp;
 }
 
 
@@ -271,26 +421,15 @@ void ResourceManager::CreateTorus(std::string object_name, float loop_radius, fl
         }
     }
 
-    // Create OpenGL buffers and copy data
-    //GLuint vao;
-    //glGenVertexArrays(1, &vao);
-    //glBindVertexArray(vao);
-
-    GLuint vbo, ebo;
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertex_num * vertex_att * sizeof(GLfloat), vertex, GL_STATIC_DRAW);
+    // Bounding sphere, used for culling
+    float bound_radius = ComputeBoundRadius(vertex, vertex_num, vertex_att);
 
-    glGenBuffers(1, &ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, face_num * face_att * sizeof(GLuint), face, GL_STATIC_DRAW);
+    // Create resource, copying the data to the geometry arena
+    AddResource(Mesh, object_name, vertex, vertex_num, vertex_att, face, face_num * face_att, bound_radius);
 
     // Free data buffers
     delete [] vertex;
     delete [] face;
-
-    // Create resource
-    AddResource(Mesh, object_name, vbo, ebo, face_num * face_att);
 }
 
 
@@ -373,26 +512,15 @@ void ResourceManager::CreateSphere(std::string object_name, float radius, int nu
         }
     }
 
-    // Create OpenGL buffers and copy data
-    //GLuint vao;
-    //glGenVertexArrays(1, &vao);
-    //glBindVertexArray(vao);
+    // Bounding sphere, used for culling
+    float bound_radius = ComputeBoundRadius(vertex, vertex_num, vertex_att);
 
-    GLuint vbo, ebo;
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertex_num * vertex_att * sizeof(GLfloat), vertex, GL_STATIC_DRAW);
-
-    glGenBuffers(1, &ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, face_num * face_att * sizeof(GLuint), face, GL_STATIC_DRAW);
+    // Create resource, copying the data to the geometry arena
+    AddResource(Mesh, object_name, vertex, vertex_num, vertex_att, face, face_num * face_att, bound_radius);
 
     // Free data buffers
     delete [] vertex;
     delete [] face;
-
-    // Create resource
-    AddResource(Mesh, object_name, vbo, ebo, face_num * face_att);
 }
 
 
@@ -404,11 +532,30 @@ void ResourceManager::LoadTexture(const std::string name, const char *filename){
         throw(std::ios_base::failure(std::string("Error loading texture ")+std::string(filename)+std::string(": ")+std::string(SOIL_last_result())));
     }
 
+    // Define texture interpolation once, instead of every time the texture
+    // is drawn
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
     // Create resource
     AddResource(Texture, name, texture, 0);
 }
 
 
+float ResourceManager::ComputeBoundRadius(const GLfloat *vertex, int num_vertices, int vertex_att){
+
+    float radius2 = 0.0;
+    for (int i = 0; i < num_vertices; i++){
+        const GLfloat *p = &vertex[i * vertex_att];
+        radius2 = std::max(radius2, p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+    }
+    return sqrt(radius2);
+}
+
+
 void ResourceManager::LoadMesh(const std::string name, const char *filename){
 
     // First load model into memory. If that goes well, we transfer the
@@ -590,16 +737,9 @@ void ResourceManager::LoadMesh(const std::string name, const char *filename){
     const int vertex_att = 11;
     const int face_att = 3;
 
-    // Create OpenGL buffers and copy data
-    GLuint vbo, ebo;
-
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, mesh.face.size() * 3 * vertex_att * sizeof(GLuint), 0, GL_STATIC_DRAW);
-
-    glGenBuffers(1, &ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.face.size() * face_att * sizeof(GLuint), 0, GL_STATIC_DRAW);
+    // Data buffers
+    std::vector<GLfloat> vertex(mesh.face.size() * 3 * vertex_att);
+    std::vector<GLuint> face(mesh.face.size() * face_att);
 
     unsigned int vertex_index = 0;
     for (unsigned int i = 0; i < mesh.face.size(); i++){
@@ -631,7 +771,7 @@ void ResourceManager::LoadMesh(const std::string name, const char *filename){
         }
 
         // Copy attributes to buffer
-        glBufferSubData(GL_ARRAY_BUFFER, i * 3 * vertex_att * sizeof(GLfloat), 3 * vertex_att * sizeof(GLfloat), att);
+        std::copy(att, att + 3 * vertex_att, vertex.begin() + i * 3 * vertex_att);
 
         // Add triangle
         GLuint findex[face_att] = { 0 };
@@ -640,11 +780,17 @@ void ResourceManager::LoadMesh(const std::string name, const char *filename){
         findex[2] = vertex_index + 2;
         vertex_index += 3;
 
-        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, i * face_att * sizeof(GLuint), face_att * sizeof(GLuint), findex);
+        std::copy(findex, findex + face_att, face.begin() + i * face_att);
+    }
+
+    // Bounding sphere, used for culling
+    float bound_radius = 0.0;
+    for (unsigned int i = 0; i < mesh.position.size(); i++){
+        bound_radius = std::max(bound_radius, glm::length(mesh.position[i]));
     }
 
     // Create resource
-    AddResource(Mesh, name, vbo, ebo, mesh.face.size() * face_att);
+    AddResource(Mesh, name, vertex.data(), mesh.face.size() * 3, vertex_att, face.data(), mesh.face.size() * face_att, bound_radius);
 }
 
 
@@ -784,19 +930,8 @@ void ResourceManager::CreateWall(std::string object_name){
     GLuint face[] = {0, 2, 1,
                      0, 3, 2};
 
-    // Create OpenGL buffers and copy data
-    GLuint vbo, ebo;
-
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, 4 * 11 * sizeof(GLfloat), vertex, GL_STATIC_DRAW);
-
-    glGenBuffers(1, &ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 2 * 3 * sizeof(GLuint), face, GL_STATIC_DRAW);
-
     // Create resource
-    AddResource(Mesh, object_name, vbo, ebo, 2 * 3);
+    AddResource(Mesh, object_name, vertex, 4, 11, face, 2 * 3, ComputeBoundRadius(vertex, 4, 11));
 }
 
 void ResourceManager::CreateSphereParticles(std::string object_name, int num_particles) {
@@ -849,17 +984,11 @@ void ResourceManager::CreateSphereParticles(std::string object_name, int num_par
         }
     }
 
-    // Create OpenGL buffer and copy data
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, num_particles * particle_att * sizeof(GLfloat), particle, GL_STATIC_DRAW);
+    // Create resource
+    AddResource(PointSet, object_name, particle, num_particles, particle_att, NULL, 0);
 
     // Free data buffers
     delete[] particle;
-
-    // Create resource
-    AddResource(PointSet, object_name, vbo, 0, num_particles);
 }
 void ResourceManager::CreateCylinder(std::string object_name, float height, float circle_radius, int num_height_samples, int num_circle_samples) {
 
@@ -877,8 +1006,6 @@ void ResourceManager::CreateCylinder(std::string object_name, float height, floa
     GLfloat* vertex = NULL;
     GLuint* face = NULL;
 
-    GLuint vbo, ebo;
-
     // Allocate memory for buffers
     try {
         vertex = new GLfloat[vertex_num * vertex_att];
@@ -999,24 +1126,63 @@ void ResourceManager::CreateCylinder(std::string object_name, float height, floa
         }
     }
 
-    // Create OpenGL buffer for vertices
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertex_num * vertex_att * sizeof(GLfloat), vertex, GL_STATIC_DRAW);
+    // Bounding sphere, used for culling
+    float bound_radius = ComputeBoundRadius(vertex, vertex_num, vertex_att);
 
-    // Create OpenGL buffer for faces
-    glGenBuffers(1, &ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, face_num * face_att * sizeof(GLuint), face, GL_STATIC_DRAW);
+    // Create resource, copying the data to the geometry arena
+    AddResource(Mesh, object_name, vertex, vertex_num, vertex_att, face, face_num * face_att, bound_radius);
 
     // Free data buffers
     delete[] vertex;
     delete[] face;
 
 
-    // Create resource
-    AddResource(Mesh, object_name, vbo, ebo, face_num * face_att);
+}
+
+
+void ResourceManager::CreateMerged(std::string object_name, const std::vector<const Resource *> &geometry, const std::vector<glm::mat4> &transform){
+
+    // Vertex layout of the parts: position, normal, then attributes that
+    // do not depend on the placement
+    int vertex_att = geometry[0]->GetVertexSize();
+    std::vector<GLfloat> vertex;
+    std::vector<GLuint> face;
+
+    std::vector<GLfloat> part_vertex;
+    std::vector<GLuint> part_face;
+    for (int i = 0; i < geometry.size(); i++){
+        const Resource *part = geometry[i];
+        if (part->GetType() != Mesh || part->GetVertexSize() != vertex_att){
+            throw(std::invalid_argument(std::string("Merged geometry must be meshes with the same vertex size")));
+        }
+        arena_.Read(part->GetGeometryIndex(), part_vertex, part_face);
 
+        // Indices of the part follow the vertices already merged
+        int part_vertex_num = part_vertex.size() / vertex_att;
+        GLuint base = vertex.size() / vertex_att;
+        for (int j = 0; j < part_face.size(); j++){
+            face.push_back(base + part_face[j]);
+        }
+
+        // Place the vertices; normals keep the scale of the normal
+        // matrix, as they do in the vertex programs
+        glm::mat3 normal_mat = glm::transpose(glm::inverse(glm::mat3(transform[i])));
+        for (int j = 0; j < part_vertex_num; j++){
+            GLfloat *v = &part_vertex[j * vertex_att];
+            glm::vec3 position = glm::vec3(transform[i] * glm::vec4(v[0], v[1], v[2], 1.0));
+            glm::vec3 normal = normal_mat * glm::vec3(v[3], v[4], v[5]);
+            v[0] = position.x;
+            v[1] = position.y;
+            v[2] = position.z;
+            v[3] = normal.x;
+            v[4] = normal.y;
+            v[5] = normal.z;
+        }
+        vertex.insert(vertex.end(), part_vertex.begin(), part_vertex.end());
+    }
+
+    int vertex_num = vertex.size() / vertex_att;
+    AddResource(Mesh, object_name, &vertex[0], vertex_num, vertex_att, &face[0], face.size(), ComputeBoundRadius(&vertex[0], vertex_num, vertex_att));
 }
 
 //particles
@@ -1067,16 +1233,10 @@ void ResourceManager::CreateMagicParticles(std::string object_name, int layer) {
         particle[i * particle_att + 14] = lifespan;
     }
 
-    // Create OpenGL buffer and copy data
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, layer * particle_att * sizeof(GLfloat), particle, GL_STATIC_DRAW);
+    // Create resource
+    AddResource(PointSet, object_name, particle, layer, particle_att, NULL, 0);
 
     // Free data buffers
     delete[] particle;
-
-    // Create resource
-    AddResource(PointSet, object_name, vbo, 0, layer);
 }
 } // namespace game;
@@ -6,13 +6,18 @@
 #define GLEW_STATIC
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
 
 #include "resource.h"
+#include "geometry_arena.h"
 
 // Default extensions for different shader source files
 #define VERTEX_PROGRAM_EXTENSION "_vp.glsl"
 #define FRAGMENT_PROGRAM_EXTENSION "_fp.glsl"
 #define GEOMETRY_PROGRAM_EXTENSION "_gp.glsl"
+#define COMPUTE_PROGRAM_EXTENSION "_cs.glsl"
+// Macro that vertex programs test to build their instanced variant
+#define INSTANCED_PROGRAM_DEFINE "INSTANCED"
 
 namespace game {
 
@@ -25,11 +30,22 @@ namespace game {
             ~ResourceManager();
             // Add a resource that was already loaded and allocated to memory
             void AddResource(ResourceType type, const std::string name, GLuint resource, GLsizei size);
-            void AddResource(ResourceType type, const std::string name, GLuint array_buffer, GLuint element_array_buffer, GLsizei size);
+            // Add a geometry, copying its vertices ('vertex_size' floats
+            // each) and indices into the geometry arena; point sets have no
+            // indices
+            void AddResource(ResourceType type, const std::string name, const GLfloat *vertex, int num_vertices, int vertex_size, const GLuint *index, int num_indices, float bound_radius = 0.0);
+            // Remove a resource; geometry goes back to the arena. Geometry
+            // that scene nodes still draw is not removed; no node may still
+            // use a material or texture
+            void RemoveResource(const std::string name);
             // Load a resource from a file, according to the specified type
             void LoadResource(ResourceType type, const std::string name, const char *filename);
+            // Load a compute program; it is added as a material of its own
+            void LoadComputeProgram(const std::string name, const char *prefix);
             // Get the resource with the specified name
             Resource *GetResource(const std::string name) const;
+            // Get the resource of a type that holds an OpenGL handle
+            Resource *GetResource(ResourceType type, GLuint handle) const;
 
             // Methods to create specific resources
             // Create the geometry for a torus and add it to the list of resources
@@ -40,20 +56,38 @@ namespace game {
             void CreateSphereParticles(std::string object_name, int num_particles = 2000);
             void CreateMagicParticles(std::string object_name, int layer=5);
             void CreateCylinder(std::string object_name, float height = 5, float circle_radius = 0.2, int num_height_samples = 90, int num_circle_samples = 30);
+            // Merge copies of meshes, each placed by a transformation, into
+            // one mesh; the meshes must have the same vertex size
+            void CreateMerged(std::string object_name, const std::vector<const Resource *> &geometry, const std::vector<glm::mat4> &transform);
 
         private:
             // List storing all resources
             std::vector<Resource*> resource_; 
+            // Buffers shared by all geometry
+            GeometryArena arena_;
  
             // Methods to load specific types of resources
             // Load shaders programs
             void LoadMaterial(const std::string name, const char *prefix);
+            // Compile and link a shader program; the geometry program may
+            // be empty
+            GLuint CreateProgram(const std::string &vp, const std::string &fp, const std::string &gp);
+            GLuint CreateComputeProgram(const std::string &cp);
+            // Insert lines into shader source after its #version line, which
+            // must come first
+            static std::string InsertAfterVersion(const std::string &source, const std::string &lines);
+            // Add the declaration of the frame constants block to shader
+            // source
+            static std::string AddFrameConstants(const std::string &source);
             // Load a text file into memory (could be source code)
             std::string LoadTextFile(const char *filename);
             // Load a texture from an image file: png, jpg, etc.
             void LoadTexture(const std::string name, const char *filename);
             // Loads a mesh in obj format
             void LoadMesh(const std::string name, const char *filename);
+            // Radius of the sphere around the origin that holds all vertex
+            // positions; the position is the first attribute of each vertex
+            static float ComputeBoundRadius(const GLfloat *vertex, int num_vertices, int vertex_att);
 
     }; // class ResourceManager
 
@@ -0,0 +1,172 @@
+#include <algorithm>
+
+#include "ring_buffer.h"
+#include "clock.h"
+
+namespace game {
+
+// Bytes per frame of a new buffer
+#define RING_SECTION_SIZE (256 * 1024)
+// Longest wait for a fence in one call, in nanoseconds
+#define RING_WAIT_TIMEOUT 1000000000
+// Access to the mapping: written by the CPU, read by the GPU while mapped
+#define RING_MAP_FLAGS (GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT)
+
+
+RingBuffer::RingBuffer(void){
+
+    buffer_ = 0;
+    mapping_ = NULL;
+    section_size_ = 0;
+    section_ = 0;
+    head_ = 0;
+    end_ = 0;
+    for (int i = 0; i < RING_FRAMES; i++){
+        fence_[i] = 0;
+    }
+    stalls_ = 0;
+    stall_time_ = 0.0;
+    growths_ = 0;
+}
+
+
+RingBuffer::~RingBuffer(){
+
+    for (int i = 0; i < RING_FRAMES; i++){
+        if (fence_[i]){
+            glDeleteSync(fence_[i]);
+        }
+    }
+    for (int i = 0; i < retired_.size(); i++){
+        glDeleteBuffers(1, &retired_[i]);
+    }
+    if (buffer_){
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glDeleteBuffers(1, &buffer_);
+    }
+}
+
+
+void RingBuffer::BeginFrame(void){
+
+    // Nothing is bound to the buffers replaced last frame any more; the
+    // GL keeps their storage until the GPU is done with it
+    for (int i = 0; i < retired_.size(); i++){
+        glDeleteBuffers(1, &retired_[i]);
+    }
+    retired_.clear();
+
+    if (!buffer_){
+        Create(RING_SECTION_SIZE);
+    }
+
+    section_ = (section_ + 1) % RING_FRAMES;
+    head_ = section_ * section_size_;
+    end_ = head_ + section_size_;
+    Wait(section_);
+}
+
+
+void RingBuffer::EndFrame(void){
+
+    fence_[section_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+
+void *RingBuffer::Allocate(GLsizeiptr size, GLsizeiptr alignment, GLintptr &offset){
+
+    GLintptr start = (head_ + alignment - 1) / alignment * alignment;
+    if (start + size > end_){
+        Grow(size + alignment);
+        start = (head_ + alignment - 1) / alignment * alignment;
+    }
+    offset = start;
+    head_ = start + size;
+    return mapping_ + start;
+}
+
+
+GLuint RingBuffer::GetBuffer(void) const {
+
+    return buffer_;
+}
+
+
+int RingBuffer::GetStalls(void) const {
+
+    return stalls_;
+}
+
+
+double RingBuffer::GetStallTime(void) const {
+
+    return stall_time_;
+}
+
+
+int RingBuffer::GetGrowths(void) const {
+
+    return growths_;
+}
+
+
+void RingBuffer::Create(GLsizeiptr section_size){
+
+    section_size_ = section_size;
+    glGenBuffers(1, &buffer_);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+    glBufferStorage(GL_COPY_WRITE_BUFFER, section_size_ * RING_FRAMES, NULL, RING_MAP_FLAGS);
+    mapping_ = (char *) glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, section_size_ * RING_FRAMES, RING_MAP_FLAGS);
+}
+
+
+void RingBuffer::Grow(GLsizeiptr size){
+
+    // Ranges of this frame in the old buffer may still be bound, so it is
+    // only deleted when the next frame begins. Its sections are not
+    // reused, so their fences are dropped
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    retired_.push_back(buffer_);
+    for (int i = 0; i < RING_FRAMES; i++){
+        if (fence_[i]){
+            glDeleteSync(fence_[i]);
+            fence_[i] = 0;
+        }
+    }
+
+    // Room for the whole frame so far, and the new range
+    GLsizeiptr used = head_ - section_ * section_size_;
+    Create(std::max(section_size_ * 2, used + size));
+    growths_++;
+
+    // The rest of the frame goes to the first section of the new buffer
+    section_ = 0;
+    head_ = 0;
+    end_ = section_size_;
+}
+
+
+void RingBuffer::Wait(int section){
+
+    if (!fence_[section]){
+        return;
+    }
+
+    // Check first without flushing, so a frame that is already done costs
+    // no round trip
+    GLenum result = glClientWaitSync(fence_[section], 0, 0);
+    if (result == GL_TIMEOUT_EXPIRED){
+        stalls_++;
+        double start = Clock::GetWallTime();
+        do {
+            result = glClientWaitSync(fence_[section], GL_SYNC_FLUSH_COMMANDS_BIT, RING_WAIT_TIMEOUT);
+        } while (result == GL_TIMEOUT_EXPIRED);
+        stall_time_ += Clock::GetWallTime() - start;
+    }
+    glDeleteSync(fence_[section]);
+    fence_[section] = 0;
+}
+
+} // namespace game
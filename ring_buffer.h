@@ -0,0 +1,75 @@
+#ifndef RING_BUFFER_H_
+#define RING_BUFFER_H_
+
+#include <vector>
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+// Frames the GPU can lag behind before writes have to wait for it
+#define RING_FRAMES 3
+
+namespace game {
+
+    // Persistently mapped buffer for data written once per frame, such as
+    // instance matrices and uniform blocks
+    // The buffer is split in one section per frame in flight. A frame
+    // allocates ranges from its section front to back, and a fence is
+    // placed when it ends; when the section comes around again the fence
+    // is waited on, so the CPU never writes memory the GPU still reads.
+    // Writes go straight into the mapping, with no driver copy or
+    // implicit sync. A frame that runs out of space moves to a larger
+    // buffer. Needs ARB_buffer_storage
+    class RingBuffer {
+
+        public:
+            RingBuffer(void);
+            ~RingBuffer();
+
+            // Start a frame: wait until the GPU is done with the section
+            // of RING_FRAMES frames ago, and allocate from it
+            void BeginFrame(void);
+            // Fence the section of the frame
+            void EndFrame(void);
+
+            // Reserve 'size' bytes, the first aligned to 'alignment';
+            // returns where to write them and sets their offset in the
+            // buffer. The memory is valid until the end of the frame
+            void *Allocate(GLsizeiptr size, GLsizeiptr alignment, GLintptr &offset);
+            // Buffer the ranges are in; changes when the buffer grows, so
+            // ask after allocating
+            GLuint GetBuffer(void) const;
+
+            // Number of times the CPU waited for the GPU, and the time it
+            // waited in seconds
+            int GetStalls(void) const;
+            double GetStallTime(void) const;
+            // Number of times a frame did not fit and the buffer grew
+            int GetGrowths(void) const;
+
+        private:
+            GLuint buffer_;
+            char *mapping_; // Start of the persistent mapping
+            GLsizeiptr section_size_; // Bytes per frame
+            int section_; // Section of the current frame
+            GLintptr head_; // Next free byte
+            GLintptr end_; // End of the section
+            GLsync fence_[RING_FRAMES]; // Set when a section is in flight
+            // Buffers replaced during the frame; their ranges may still be
+            // bound until it ends
+            std::vector<GLuint> retired_;
+            int stalls_;
+            double stall_time_;
+            int growths_;
+
+            // Create and map the buffer with 'section_size' bytes per frame
+            void Create(GLsizeiptr section_size);
+            // Move to a buffer that can hold 'size' more bytes this frame
+            void Grow(GLsizeiptr size);
+            // Wait for the fence of a section, if any
+            void Wait(int section);
+
+    }; // class RingBuffer
+
+} // namespace game
+
+#endif // RING_BUFFER_H_
@@ -1,18 +1,25 @@
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <map>
 #define GLM_FORCE_RADIANS
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "scene_graph.h"
+#include "program_info.h"
+#include "profiler.h"
 
 namespace game {
 
 SceneGraph::SceneGraph(void){
 
     background_color_ = glm::vec3(0.0, 0.0, 0.0);
+    jobs_ = NULL;
+    screen_buffer_ = 0;
 }
 
 
@@ -38,29 +45,233 @@ SceneNode *SceneGraph::CreateNode(std::string node_name, Resource *geometry, Res
     SceneNode *scn = new SceneNode(node_name, geometry, material, texture);
 
     // Add node to the scene
-    node_.push_back(scn);
+    AddNode(scn);
 
     return scn;
 }
 
 
-void SceneGraph::AddNode(SceneNode *node){
+NodeHandle SceneGraph::AddNode(SceneNode *node){
+
+    // Register the node in the handle table and the name index
+    NodeHandle handle = handles_.Insert(node);
+    node->SetHandle(handle);
+    name_index_[node->GetName()].push_back(handle);
+
+    // Move the transformation of the node into the store
+    transforms_.Add(handle.index);
+    node->SetTransformStore(&transforms_, handle.index);
+
+    // Queue the node for drawing; its render layer is part of the draw
+    // key, so drawing does not need to classify nodes every frame
+    queue_.Add(node);
+
+    // Index the bounds of the node for culling and spatial queries
+    if (proxy_.size() < handles_.GetCapacity()){
+        proxy_.resize(handles_.GetCapacity(), -1);
+        visible_.resize(handles_.GetCapacity(), 0);
+    }
+    proxy_[handle.index] = -1;
+    if (node->GetCullable()){
+        glm::vec3 center;
+        float radius;
+        transforms_.Compose(handle.index);
+        node->GetWorldBounds(center, radius);
+        proxy_[handle.index] = bvh_.Insert(node, center, radius, node->GetStatic());
+    }
 
     node_.push_back(node);
+
+    return handle;
+}
+
+
+SceneNode *SceneGraph::RemoveNode(NodeHandle handle){
+
+    SceneNode *node = handles_.Remove(handle);
+    if (!node){
+        return NULL;
+    }
+
+    // Drop the node from the name index
+    std::unordered_map<std::string, std::vector<NodeHandle> >::iterator it = name_index_.find(node->GetName());
+    if (it != name_index_.end()){
+        std::vector<NodeHandle> &same_name = it->second;
+        for (int i = 0; i < same_name.size(); i++){
+            if (same_name[i] == handle){
+                same_name.erase(same_name.begin() + i);
+                break;
+            }
+        }
+        if (same_name.size() == 0){
+            name_index_.erase(it);
+        }
+    }
+
+    // Drop the node from the spatial index and the list of nodes to render
+    if (proxy_[handle.index] != -1){
+        bvh_.Remove(proxy_[handle.index]);
+        proxy_[handle.index] = -1;
+    }
+    queue_.Remove(node);
+    if (node->GetTransformStore()){
+        node->SetTransformStore(NULL, 0);
+        transforms_.Remove(handle.index);
+    }
+    for (int i = 0; i < node_.size(); i++){
+        if (node_[i] == node){
+            node_.erase(node_.begin() + i);
+            break;
+        }
+    }
+
+    node->SetHandle(NodeHandle());
+    return node;
 }
 
 
-SceneNode *SceneGraph::GetNode(std::string node_name) const {
+SceneNode *SceneGraph::GetNode(const std::string &node_name) const {
+
+    return handles_.Get(GetHandle(node_name));
+}
+
+
+SceneNode *SceneGraph::GetNode(NodeHandle handle) const {
+
+    return handles_.Get(handle);
+}
+
+
+NodeHandle SceneGraph::GetHandle(const std::string &node_name) const {
 
     // Find node with the specified name
+    std::unordered_map<std::string, std::vector<NodeHandle> >::const_iterator it = name_index_.find(node_name);
+    if (it == name_index_.end()){
+        return NodeHandle();
+    }
+    return it->second.front();
+}
+
+
+void SceneGraph::UpdateBounds(void){
+
+    transforms_.Compose();
+
+    const std::vector<int> &moved = transforms_.GetMoved();
+    for (int i = 0; i < moved.size(); i++){
+        queue_.Move(moved[i]);
+        int proxy = proxy_[moved[i]];
+        if (proxy != -1){
+            glm::vec3 center;
+            float radius;
+            handles_.GetAt(moved[i])->GetWorldBounds(center, radius);
+            bvh_.Move(proxy, center, radius);
+        }
+    }
+    transforms_.ClearMoved();
+}
+
+
+void SceneGraph::BakeStatic(ResourceManager *resman){
+
+    // World transforms of the nodes placed since the last update
+    UpdateBounds();
+
+    // Nodes to merge, by material and texture; nodes in a hierarchy are
+    // left alone, since their parent or children can move, and so are
+    // materials lit in the frame of the node, which would change on merged
+    // geometry
+    std::map<std::pair<GLuint, GLuint>, std::vector<SceneNode *> > group;
     for (int i = 0; i < node_.size(); i++){
-        if (node_[i]->GetName() == node_name){
-            return node_[i];
+        SceneNode *node = node_[i];
+        Resource *material = resman->GetResource(Material, node->GetMaterial());
+        if (node->GetStatic() && node->GetTransformStore() &&
+            material && material->GetMergeable() &&
+            node->GetLayer() == OpaqueLayer && node->GetMode() == GL_TRIANGLES &&
+            !node->GetParent() && node->GetChildren().size() == 0){
+            group[std::make_pair(node->GetMaterial(), node->GetTexture())].push_back(node);
         }
     }
-    return NULL;
 
+    int chunk_num = 0;
+    for (std::map<std::pair<GLuint, GLuint>, std::vector<SceneNode *> >::iterator it = group.begin(); it != group.end(); it++){
+        std::vector<SceneNode *> &nodes = it->second;
+        if (nodes.size() < 2){
+            continue;
+        }
+
+        // Box around the bounds of the nodes
+        glm::vec3 min, max;
+        for (int i = 0; i < nodes.size(); i++){
+            glm::vec3 center;
+            float radius;
+            nodes[i]->GetWorldBounds(center, radius);
+            if (i == 0){
+                min = center - glm::vec3(radius);
+                max = center + glm::vec3(radius);
+            } else {
+                min = glm::min(min, center - glm::vec3(radius));
+                max = glm::max(max, center + glm::vec3(radius));
+            }
+        }
+        glm::vec3 center = (min + max) * 0.5f;
+
+        // Geometry in world space, relative to the center, so that the
+        // bounding sphere of the merged node fits the group
+        std::vector<const Resource *> geometry;
+        std::vector<glm::mat4> transform;
+        glm::mat4 to_center = glm::translate(glm::mat4(1.0), -center);
+        for (int i = 0; i < nodes.size(); i++){
+            geometry.push_back(nodes[i]->GetGeometry());
+            transform.push_back(to_center * nodes[i]->GetWorldTransform());
+        }
+        std::stringstream ss;
+        ss << "StaticChunk" << chunk_num++;
+        std::string name = ss.str();
+        resman->CreateMerged(name, geometry, transform);
+
+        SceneNode *chunk = new SceneNode(name, resman->GetResource(name), resman->GetResource(Material, it->first.first), resman->GetResource(Texture, it->first.second));
+        chunk->SetStatic(true);
+        chunk->SetPosition(center);
+        AddNode(chunk);
+
+        // Keep the merged nodes out of drawing, culling and updates
+        for (int i = 0; i < nodes.size(); i++){
+            SceneNode *node = nodes[i];
+            int index = node->GetHandle().index;
+            queue_.Remove(node);
+            if (proxy_[index] != -1){
+                bvh_.Remove(proxy_[index]);
+                proxy_[index] = -1;
+            }
+            node->SetTransformStore(NULL, 0);
+            transforms_.Remove(index);
+        }
+    }
+}
+
+
+void SceneGraph::GetNodesInFrustum(const Frustum &frustum, std::vector<SceneNode *> &result){
+
+    UpdateBounds();
+    bvh_.QueryFrustum(frustum, result);
+}
+
+
+void SceneGraph::GetNodesInSphere(glm::vec3 center, float radius, std::vector<SceneNode *> &result){
+
+    UpdateBounds();
+    bvh_.QuerySphere(center, radius, result);
+}
+
+
+void SceneGraph::GetNodesOnRay(glm::vec3 origin, glm::vec3 direction, float max_distance, std::vector<SceneNode *> &result, std::vector<float> &distance){
+
+    UpdateBounds();
+    bvh_.QueryRay(origin, direction, max_distance, result, distance);
 }
+
+
 std::vector<SceneNode *>::const_iterator SceneGraph::begin() const {
 
     return node_.begin();
@@ -73,42 +284,122 @@ std::vector<SceneNode *>::const_iterator SceneGraph::end() const {
 }
 
 
-void SceneGraph::Draw(Camera *camera, Light *light){
-    
+void SceneGraph::Draw(void){
+
+    ProfileZone zone("SceneGraph::Draw", true);
 
     // Clear background
     glClearColor(background_color_[0], 
                  background_color_[1],
                  background_color_[2], 0.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glDisable(GL_DEPTH_TEST);
-    GetNode("front")->Draw(camera, light);
-    GetNode("back")->Draw(camera, light);
-    GetNode("right")->Draw(camera, light);
-    GetNode("left")->Draw(camera, light);
-    GetNode("top")->Draw(camera, light);
-    GetNode("bottom")->Draw(camera, light);
-    glEnable(GL_DEPTH_TEST);
+
     // Draw all scene nodes
-    
-    for (int i = 0; i < node_.size(); i++){
-        if (node_[i]->GetName() != "front" && node_[i]->GetName() != "back" && node_[i]->GetName() != "top" && node_[i]->GetName() != "bottom" && node_[i]->GetName() != "left" && node_[i]->GetName() != "right") {
-            node_[i]->Draw(camera,light);
-        }
-        
+    queue_.Submit();
+}
+
+
+void SceneGraph::Prepare(Camera *camera, Light *light){
+
+    ProfileZone zone("SceneGraph::Prepare", true);
+
+    // Find what the camera can see; this composes every changed slot
+    // first, so the draw order and the recording only read matrices
+    GetNodesInFrustum(camera->GetFrustum(), visible_nodes_);
+    std::fill(visible_.begin(), visible_.end(), 0);
+    for (int i = 0; i < visible_nodes_.size(); i++){
+        visible_[visible_nodes_[i]->GetHandle().index] = 1;
     }
-    
-    
-    
-    
 
-    
+    // Bring the draw order up to date and submit the visible nodes
+    queue_.Sort(camera->GetPosition());
+    queue_.Cull(visible_);
+    queue_.Prepare(camera, light);
+}
+
+
+void SceneGraph::SetCullProgram(GLuint program){
+
+    queue_.SetCullProgram(program);
+}
+
+
+GLuint SceneGraph::GetCullProgram(void) const {
+
+    return queue_.GetCullProgram();
+}
+
+
+const DrawStats &SceneGraph::GetDrawStats(void) const {
+
+    return queue_.GetStats();
+}
+
+
+void SceneGraph::SetJobSystem(JobSystem *jobs){
+
+    jobs_ = jobs;
+    queue_.SetJobSystem(jobs);
 }
 
 
 void SceneGraph::Update(void){
-    for (int i = 0; i < node_.size(); i++){
-        node_[i]->Update();
+
+    ProfileZone zone("SceneGraph::Update");
+
+    // Update the nodes one hierarchy level at a time, so that parents are
+    // done before their children; the nodes of a level are independent
+    const std::vector<int> &order = transforms_.GetOrder();
+    const std::vector<int> &level_start = transforms_.GetLevelStart();
+    for (int level = 0; level + 1 < level_start.size(); level++){
+        const int *slot = order.data() + level_start[level];
+        int count = level_start[level + 1] - level_start[level];
+        UpdateRange(count, [this, slot](int begin, int end){
+            for (int i = begin; i < end; i++){
+                handles_.GetAt(slot[i])->Update();
+            }
+        });
+    }
+
+    // Per-frame rotations of all the nodes
+    UpdateRange(transforms_.GetSlotCount(), [this](int begin, int end){
+        transforms_.ApplySpins(begin, end);
+    });
+
+    UpdateBounds();
+}
+
+
+void SceneGraph::BeginStep(void){
+
+    transforms_.BeginStep();
+}
+
+
+void SceneGraph::EndStep(void){
+
+    transforms_.EndStep();
+}
+
+
+void SceneGraph::Interpolate(float alpha){
+
+    transforms_.Interpolate(alpha);
+}
+
+
+void SceneGraph::EndInterpolation(void){
+
+    transforms_.EndInterpolation();
+}
+
+
+void SceneGraph::UpdateRange(int count, const std::function<void(int begin, int end)> &body){
+
+    if (jobs_){
+        jobs_->ParallelFor(count, SCENE_UPDATE_GRAIN, body);
+    } else if (count > 0){
+        body(0, count);
     }
 }
 
@@ -145,7 +436,7 @@ void SceneGraph::SetupDrawToTexture(void){
     }
 
     // Reset frame buffer
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, screen_buffer_);
 
     // Set up quad for drawing to the screen
     static const GLfloat quad_vertex_data[] = {
@@ -164,7 +455,9 @@ void SceneGraph::SetupDrawToTexture(void){
 }
 
 
-void SceneGraph::DrawToTexture(Camera* camera, Light* light) {
+void SceneGraph::DrawToTexture(void) {
+
+    ProfileZone zone("SceneGraph::DrawToTexture", true);
 
     // Save current viewport
     GLint viewport[4];
@@ -179,23 +472,12 @@ void SceneGraph::DrawToTexture(Camera* camera, Light* light) {
         background_color_[1],
         background_color_[2], 0.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glDisable(GL_DEPTH_TEST);
-    GetNode("front")->Draw(camera, light);
-    GetNode("back")->Draw(camera, light);
-    GetNode("right")->Draw(camera, light);
-    GetNode("left")->Draw(camera, light);
-    GetNode("top")->Draw(camera, light);
-    GetNode("bottom")->Draw(camera, light);
-    glEnable(GL_DEPTH_TEST);
+
     // Draw all scene nodes
-    for (int i = 0; i < node_.size(); i++) {
-        if (node_[i]->GetName() != "front" && node_[i]->GetName() != "back" && node_[i]->GetName() != "top" && node_[i]->GetName() != "bottom" && node_[i]->GetName() != "left" && node_[i]->GetName() != "right") {
-            node_[i]->Draw(camera, light);
-        }
-    }
+    queue_.Submit();
 
     // Reset frame buffer
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, screen_buffer_);
 
     // Restore viewport
     glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
@@ -204,30 +486,31 @@ void SceneGraph::DrawToTexture(Camera* camera, Light* light) {
 
 void SceneGraph::DisplayTexture(GLuint program){
 
+    ProfileZone zone("SceneGraph::DisplayTexture", true);
+
     // Configure output to the screen
     //glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glDisable(GL_DEPTH_TEST);
 
-    // Set up quad geometry
+    // Set up quad geometry; the quad is not a resource, so it is fed
+    // through the default vertex array
+    glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, quad_array_buffer_);
 
     // Select proper material (shader program)
     glUseProgram(program);
 
+    const ProgramInfo &info = ProgramInfo::Get(program);
+
     // Setup attributes of screen-space shader
-    GLint pos_att = glGetAttribLocation(program, "position");
+    GLint pos_att = info.GetAttribute(PositionAttribute);
     glEnableVertexAttribArray(pos_att);
     glVertexAttribPointer(pos_att, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), 0);
 
-    GLint tex_att = glGetAttribLocation(program, "uv");
+    GLint tex_att = info.GetAttribute(UvAttribute);
     glEnableVertexAttribArray(tex_att);
     glVertexAttribPointer(tex_att, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void *) (3*sizeof(GLfloat)));
 
-    // Timer
-    GLint timer_var = glGetUniformLocation(program, "timer");
-    float current_time = glfwGetTime();
-    glUniform1f(timer_var, current_time);
-
     // Bind texture
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, texture_);
@@ -276,7 +559,13 @@ void SceneGraph::SaveTexture(char *filename){
     f.close();
 
     // Reset frame buffer
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, screen_buffer_);
+}
+
+
+void SceneGraph::SetScreenFramebuffer(GLuint frame_buffer){
+
+    screen_buffer_ = frame_buffer;
 }
 
 } // namespace game
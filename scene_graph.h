@@ -3,17 +3,28 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
 #define GLEW_STATIC
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
 #include "scene_node.h"
+#include "node_handle.h"
+#include "handle_table.h"
+#include "transform_store.h"
+#include "job_system.h"
+#include "draw_queue.h"
+#include "bvh.h"
+#include "frustum.h"
 #include "resource.h"
+#include "resource_manager.h"
 #include "camera.h"
 #include "light.h"
 // Size of the texture that we will draw
 #define FRAME_BUFFER_WIDTH 1024
 #define FRAME_BUFFER_HEIGHT 768
+// Number of nodes updated by one job
+#define SCENE_UPDATE_GRAIN 64
 
 namespace game {
 
@@ -27,8 +38,35 @@ namespace game {
             // Scene nodes to render
             std::vector<SceneNode *> node_;
 
+            // Handles of all nodes in the scene
+            HandleTable handles_;
+            // Handles of the nodes with a given name, in insertion order
+            std::unordered_map<std::string, std::vector<NodeHandle> > name_index_;
+
+            // Transformations of the nodes, by handle index
+            TransformStore transforms_;
+
+            // Threads to update the nodes on; NULL to update them on the
+            // calling thread
+            JobSystem *jobs_;
+
+            // Scene nodes in draw order, grouped by render layer and state
+            DrawQueue queue_;
+
+            // Spatial index over the bounds of the nodes that can be culled
+            Bvh bvh_;
+            // Leaf of each node in the spatial index, by handle index; -1
+            // for nodes that are not indexed
+            std::vector<int> proxy_;
+            // Visibility of the nodes in the current frame, by handle index
+            std::vector<unsigned char> visible_;
+            // Result of the last visibility query
+            std::vector<SceneNode *> visible_nodes_;
+
             // Frame buffer for drawing to texture
             GLuint frame_buffer_;
+            // Frame buffer that stands for the screen; zero for the window
+            GLuint screen_buffer_;
             // Quad vertex array for drawing from texture
             GLuint quad_array_buffer_;
             // Render targets
@@ -48,28 +86,88 @@ namespace game {
             // Create a scene node from the specified resources
             SceneNode *CreateNode(std::string node_name, Resource *geometry, Resource *material, Resource *texture = NULL);
             // Add an already-created node
-            void AddNode(SceneNode *node);
+            NodeHandle AddNode(SceneNode *node);
+            // Take a node out of the scene; its handle becomes stale and
+            // the node is returned to the caller
+            SceneNode *RemoveNode(NodeHandle handle);
             // Find a scene node with a specific name
-            SceneNode *GetNode(std::string node_name) const;
+            // If several nodes share the name, the first one added is returned
+            SceneNode *GetNode(const std::string &node_name) const;
+            // Find a scene node from its handle, or NULL if it was removed
+            SceneNode *GetNode(NodeHandle handle) const;
+            // Get the handle of the first node with a specific name
+            NodeHandle GetHandle(const std::string &node_name) const;
+            // Spatial queries over the bounding spheres of the nodes
+            // Nodes that are never culled (sky, particles) are not included
+            void GetNodesInFrustum(const Frustum &frustum, std::vector<SceneNode *> &result);
+            void GetNodesInSphere(glm::vec3 center, float radius, std::vector<SceneNode *> &result);
+            // Nodes hit by a ray, with the distance of each hit
+            void GetNodesOnRay(glm::vec3 origin, glm::vec3 direction, float max_distance, std::vector<SceneNode *> &result, std::vector<float> &distance);
+            // Merge the static opaque nodes that share a material and a
+            // texture into one static node, with their geometry in world
+            // space around the center of the group. The merged nodes stay
+            // in the scene for queries by name or handle, but are no longer
+            // drawn, indexed or updated
+            void BakeStatic(ResourceManager *resman);
             // Get node const iterator
             std::vector<SceneNode *>::const_iterator begin() const;
             std::vector<SceneNode *>::const_iterator end() const;
 
+            // Drawing, in two halves
+            // Prepare composes the changed transformations, finds the nodes
+            // 'camera' sees and records their draws; it is the last access
+            // to the nodes for the frame, so the scene can be updated for
+            // the next frame while Draw or DrawToTexture issue the recorded
+            // draws on the GL thread
+            void Prepare(Camera *camera, Light *light);
             // Draw the entire scene
-            void Draw(Camera *camera, Light* light);
+            void Draw(void);
 
             // Update entire scene
+            // Nodes are updated and their draws recorded in parallel if a
+            // job system is set, so their Update must only change the node
+            // itself
             void Update(void);
+            void SetJobSystem(JobSystem *jobs);
+
+            // Fixed simulation steps
+            // Call BeginStep before changing the nodes in a step, and
+            // EndStep after its Update. Interpolate places the nodes the
+            // last step moved 'alpha' of the way through it, for drawing,
+            // and EndInterpolation puts them back once drawn
+            void BeginStep(void);
+            void EndStep(void);
+            void Interpolate(float alpha);
+            void EndInterpolation(void);
 
             // Drawing from/to a texture
             // Setup the texture
             void SetupDrawToTexture(void);
             // Draw the scene into a texture
-            void DrawToTexture(Camera *camera, Light* light);
+            void DrawToTexture(void);
             // Process and draw the texture on the screen
             void DisplayTexture(GLuint program);
             // Save texture to a file in ppm format
             void SaveTexture(char *filename);
+            // Frame buffer the scene is shown in when it is not drawn to
+            // the texture; zero for the window, or an offscreen buffer
+            // when there is no window
+            void SetScreenFramebuffer(GLuint frame_buffer);
+
+            // Cull and draw the opaque nodes on the GPU with a compute
+            // program; zero to draw every node from the CPU
+            void SetCullProgram(GLuint program);
+            GLuint GetCullProgram(void) const;
+
+            // Statistics of the last draw
+            const DrawStats &GetDrawStats(void) const;
+
+        private:
+            // Run 'body' over [0, count), on the job system if there is one
+            void UpdateRange(int count, const std::function<void(int begin, int end)> &body);
+            // Rebuild the matrices that changed and bring the spatial index
+            // up to date with the nodes that moved
+            void UpdateBounds(void);
 
     }; // class SceneGraph
 
@@ -1,4 +1,5 @@
 #include <stdexcept>
+#include <algorithm>
 #define GLM_FORCE_RADIANS
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -6,6 +7,7 @@
 #include <time.h>
 
 #include "scene_node.h"
+#include "program_info.h"
 
 namespace game {
     SceneNode::SceneNode(const std::string name, const Resource* geometry, const Resource* material, const Resource* texture) {
@@ -24,9 +26,9 @@ namespace game {
             throw(std::invalid_argument(std::string("Invalid type of geometry")));
         }
 
-        array_buffer_ = geometry->GetArrayBuffer();
-        element_array_buffer_ = geometry->GetElementArrayBuffer();
+        geometry_ = geometry;
         size_ = geometry->GetSize();
+        bound_radius_ = geometry->GetBoundRadius();
 
         // Set material (shader program)
         if (material->GetType() != Material) {
@@ -34,6 +36,12 @@ namespace game {
         }
 
         material_ = material->GetResource();
+        instanced_material_ = material->GetInstancedResource();
+
+        // Vertex attribute layouts, shared with the other nodes that draw
+        // the same geometry with the same program
+        vertex_array_ = geometry->GetVertexArray(material_);
+        instanced_vertex_array_ = geometry->GetVertexArray(instanced_material_);
 
         // Set texture
         if (texture) {
@@ -46,34 +54,65 @@ namespace game {
         // Other attributes
         scale_ = glm::vec3(1.0, 1.0, 1.0);
         blending_ = false;
+        layer_ = (mode_ == GL_POINTS) ? ParticleLayer : OpaqueLayer;
+        static_ = false;
+        parent_ = NULL;
+        pivot_ = glm::vec3(0.0, 0.0, 0.0);
+        transforms_ = NULL;
+        slot_ = -1;
+
+        // Keep the geometry from being removed while the node draws it
+        geometry_->AddUser();
     }
 
 
     SceneNode::~SceneNode() {
+
+        // Detach from the hierarchy; the children keep their local
+        // placement
+        SetParent(NULL);
+        for (int i = 0; i < children_.size(); i++) {
+            children_[i]->parent_ = NULL;
+            children_[i]->UpdateParentSlot();
+        }
+
+        geometry_->RemoveUser();
     }
 
 
-    const std::string SceneNode::GetName(void) const {
+    const std::string &SceneNode::GetName(void) const {
 
         return name_;
     }
 
 
+    NodeHandle SceneNode::GetHandle(void) const {
+
+        return handle_;
+    }
+
+
+    void SceneNode::SetHandle(NodeHandle handle) {
+
+        handle_ = handle;
+    }
+
+
     glm::vec3 SceneNode::GetPosition(void) const {
 
-        return position_;
+        return transforms_ ? transforms_->GetPosition(slot_) : position_;
     }
 
 
     glm::quat SceneNode::GetOrientation(void) const {
 
-        return orientation_;
+        return transforms_ ? transforms_->GetOrientation(slot_) : orientation_;
     }
 
 
     glm::vec3 SceneNode::GetScale(void) const {
 
-        return scale_;
+        return transforms_ ? transforms_->GetScale(slot_) : scale_;
     }
 
 
@@ -93,6 +132,12 @@ namespace game {
         return blending_;
     }
 
+
+    RenderLayer SceneNode::GetLayer(void) const {
+
+        return layer_;
+    }
+
     SceneNode* SceneNode::GetPlayer(void) const {
 
         return player_;
@@ -124,19 +169,34 @@ namespace game {
 
     void SceneNode::SetPosition(glm::vec3 position) {
 
-        position_ = position;
+        if (transforms_) {
+            transforms_->SetPosition(slot_, position);
+        }
+        else {
+            position_ = position;
+        }
     }
 
 
     void SceneNode::SetOrientation(glm::quat orientation) {
 
-        orientation_ = orientation;
+        if (transforms_) {
+            transforms_->SetOrientation(slot_, orientation);
+        }
+        else {
+            orientation_ = orientation;
+        }
     }
 
 
     void SceneNode::SetScale(glm::vec3 scale) {
 
-        scale_ = scale;
+        if (transforms_) {
+            transforms_->SetScale(slot_, scale);
+        }
+        else {
+            scale_ = scale;
+        }
     }
 
 
@@ -153,43 +213,83 @@ namespace game {
 
     void SceneNode::Translate(glm::vec3 trans) {
 
-        position_ += trans;
+        SetPosition(GetPosition() + trans);
     }
 
 
     void SceneNode::Rotate(glm::quat rot) {
 
-        orientation_ *= rot;
-        orientation_ = glm::normalize(orientation_);
+        SetOrientation(glm::normalize(GetOrientation() * rot));
     }
 
 
     void SceneNode::Scale(glm::vec3 scale) {
 
-        scale_ *= scale;
+        SetScale(GetScale() * scale);
     }
 
 
     void SceneNode::SetBlending(bool blending) {
 
         blending_ = blending;
+        if (layer_ == OpaqueLayer && blending) {
+            layer_ = BlendedLayer;
+        }
+        else if (layer_ == BlendedLayer && !blending) {
+            layer_ = OpaqueLayer;
+        }
     }
 
-    GLenum SceneNode::GetMode(void) const {
 
-        return mode_;
+    void SceneNode::SetLayer(RenderLayer layer) {
+
+        layer_ = layer;
     }
 
 
-    GLuint SceneNode::GetArrayBuffer(void) const {
+    glm::quat SceneNode::GetSpin(void) const {
 
-        return array_buffer_;
+        return transforms_ ? transforms_->GetSpin(slot_) : spin_;
     }
 
 
-    GLuint SceneNode::GetElementArrayBuffer(void) const {
+    void SceneNode::SetSpin(glm::quat spin) {
 
-        return element_array_buffer_;
+        if (transforms_) {
+            transforms_->SetSpin(slot_, spin);
+        }
+        else {
+            spin_ = spin;
+        }
+    }
+
+
+    bool SceneNode::GetCullable(void) const {
+
+        return bound_radius_ > 0.0 && (layer_ == OpaqueLayer || layer_ == BlendedLayer);
+    }
+
+
+    bool SceneNode::GetStatic(void) const {
+
+        return static_;
+    }
+
+
+    void SceneNode::SetStatic(bool is_static) {
+
+        static_ = is_static;
+    }
+
+    GLenum SceneNode::GetMode(void) const {
+
+        return mode_;
+    }
+
+
+    const Resource *SceneNode::GetGeometry(void) const {
+
+        return geometry_;
     }
 
 
@@ -204,170 +304,234 @@ namespace game {
         return material_;
     }
 
-    void SceneNode::SetTrans(glm::mat4 o) {
-        finaltrans_ = o;
+
+    GLuint SceneNode::GetInstancedMaterial(void) const {
+
+        return instanced_material_;
+    }
+
+
+    GLuint SceneNode::GetVertexArray(void) const {
+
+        return vertex_array_;
+    }
+
+
+    GLuint SceneNode::GetInstancedVertexArray(void) const {
+
+        return instanced_vertex_array_;
     }
+
+
+    GLuint SceneNode::GetTexture(void) const {
+
+        return texture_;
+    }
+
     void SceneNode::SetTexture(Resource* texture) {
         texture_ = texture->GetResource();
     }
-    glm::mat4 SceneNode::GetTrans() {
-        return finaltrans_;
-    }
 
 
-    void SceneNode::Draw(Camera* camera, Light* light) {
+    SceneNode *SceneNode::GetParent(void) const {
 
-        // Select particle blending or not
-        if (blending_) {
-            // Disable depth write
-            glDepthMask(GL_FALSE);
+        return parent_;
+    }
 
-            // Enable blending
-            glEnable(GL_BLEND);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); // Simpler form
 
+    void SceneNode::SetParent(SceneNode *parent) {
+
+        if (parent_ == parent) {
+            return;
         }
-        else {
-            // Enable z-buffer
-            glDepthMask(GL_TRUE);
-            glDepthFunc(GL_LESS);
+        if (parent_) {
+            std::vector<SceneNode *> &siblings = parent_->children_;
+            siblings.erase(std::remove(siblings.begin(), siblings.end(), this), siblings.end());
         }
+        parent_ = parent;
+        if (parent_) {
+            parent_->children_.push_back(this);
+        }
+        UpdateParentSlot();
+    }
 
-        // Select proper material (shader program)
-        glUseProgram(material_);
 
-        // Set geometry to draw
-        glBindBuffer(GL_ARRAY_BUFFER, array_buffer_);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_array_buffer_);
+    const std::vector<SceneNode *> &SceneNode::GetChildren(void) const {
 
-        // Set globals for camera
-        camera->SetupShader(material_);
-        light->SetupShader(material_);
+        return children_;
+    }
 
-        // Set world matrix and other shader input variables
-        SetupShader(material_);
-        // Draw geometry
-        if (mode_ == GL_POINTS) {
-            glDrawArrays(mode_, 0, size_);
+
+    glm::vec3 SceneNode::GetPivot(void) const {
+
+        return transforms_ ? transforms_->GetPivot(slot_) : pivot_;
+    }
+
+
+    void SceneNode::SetPivot(glm::vec3 pivot) {
+
+        if (transforms_) {
+            transforms_->SetPivot(slot_, pivot);
         }
         else {
-            glDrawElements(mode_, size_, GL_UNSIGNED_INT, 0);
+            pivot_ = pivot;
         }
     }
 
 
-    void SceneNode::Update(void) {
-        if (GetName().find("magic") == 0 || GetName().find("Door") == 0){
-            if (GetPlayer()->GetInteraction() == GetName()) {
-                float distance = glm::distance(glm::vec2(GetPlayer()->GetPosition().x, GetPlayer()->GetPosition().z), glm::vec2(GetPosition().x, GetPosition().z));
-                if (distance < 15) {
-                    GetPlayer()->SetInteraction(GetName());
-                }
-                else {
-                    GetPlayer()->SetInteraction("Nothing");
-                }
-            }
-            else if (GetPlayer()->GetInteraction() == "Nothing") {
-                float distance = glm::distance(glm::vec2(GetPlayer()->GetPosition().x, GetPlayer()->GetPosition().z), glm::vec2(GetPosition().x, GetPosition().z));
-                if (distance < 15) {
-                    GetPlayer()->SetInteraction(GetName());
-                }
-            }
+    void SceneNode::SetTransformStore(TransformStore *transforms, int slot) {
+
+        if (transforms_) {
+            // Keep the placement in the node while it is out of a store
+            position_ = transforms_->GetPosition(slot_);
+            orientation_ = transforms_->GetOrientation(slot_);
+            scale_ = transforms_->GetScale(slot_);
+            pivot_ = transforms_->GetPivot(slot_);
+            spin_ = transforms_->GetSpin(slot_);
         }
 
-        // Do nothing for this generic type of scene node
-    }
+        transforms_ = transforms;
+        slot_ = transforms ? slot : -1;
 
+        if (transforms_) {
+            transforms_->SetPosition(slot_, position_);
+            transforms_->SetOrientation(slot_, orientation_);
+            transforms_->SetScale(slot_, scale_);
+            transforms_->SetPivot(slot_, pivot_);
+            transforms_->SetSpin(slot_, spin_);
+        }
+
+        // Links between nodes of the same store are mirrored in it
+        UpdateParentSlot();
+        for (int i = 0; i < children_.size(); i++) {
+            children_[i]->UpdateParentSlot();
+        }
+    }
 
-    void SceneNode::SetupShader(GLuint program) {
-        // Set attributes for shaders
-        if (name_.find("magic")==0) {
-            // Set attributes for shaders
-            GLint vertex_att = glGetAttribLocation(program, "vertex");
-            glVertexAttribPointer(vertex_att, 3, GL_FLOAT, GL_FALSE, 15 * sizeof(GLfloat), 0);
-            glEnableVertexAttribArray(vertex_att);
 
-            GLint normal_att = glGetAttribLocation(program, "normal");
-            glVertexAttribPointer(normal_att, 3, GL_FLOAT, GL_FALSE, 15 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
-            glEnableVertexAttribArray(normal_att);
+    TransformStore *SceneNode::GetTransformStore(void) const {
 
-            GLint color_att = glGetAttribLocation(program, "color");
-            glVertexAttribPointer(color_att, 3, GL_FLOAT, GL_FALSE, 15 * sizeof(GLfloat), (void*)(6 * sizeof(GLfloat)));
-            glEnableVertexAttribArray(color_att);
+        return transforms_;
+    }
 
-            GLint tex_att = glGetAttribLocation(program, "uv");
-            glVertexAttribPointer(tex_att, 2, GL_FLOAT, GL_FALSE, 15 * sizeof(GLfloat), (void*)(9 * sizeof(GLfloat)));
-            glEnableVertexAttribArray(tex_att);
 
-            GLint property_att = glGetAttribLocation(program, "particle_property");
-            glVertexAttribPointer(property_att, 3, GL_FLOAT, GL_FALSE, 15 * sizeof(GLfloat), (void*)(11 * sizeof(GLfloat)));
-            glEnableVertexAttribArray(property_att);
+    void SceneNode::UpdateParentSlot(void) {
 
-            GLint life_att = glGetAttribLocation(program, "lifespan");
-            glVertexAttribPointer(life_att, 1, GL_FLOAT, GL_FALSE, 15 * sizeof(GLfloat), (void*)(14 * sizeof(GLfloat)));
-            glEnableVertexAttribArray(life_att);
+        if (!transforms_) {
+            return;
+        }
+        if (parent_ && parent_->transforms_ == transforms_) {
+            transforms_->SetParent(slot_, parent_->slot_);
         }
         else {
-            GLint vertex_att = glGetAttribLocation(program, "vertex");
-            glVertexAttribPointer(vertex_att, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), 0);
-            glEnableVertexAttribArray(vertex_att);
+            transforms_->SetParent(slot_, -1);
+        }
+    }
 
-            GLint normal_att = glGetAttribLocation(program, "normal");
-            glVertexAttribPointer(normal_att, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
-            glEnableVertexAttribArray(normal_att);
 
-            GLint color_att = glGetAttribLocation(program, "color");
-            glVertexAttribPointer(color_att, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (void*)(6 * sizeof(GLfloat)));
-            glEnableVertexAttribArray(color_att);
+    glm::mat4 SceneNode::GetWorldMatrix(void) const {
 
-            GLint tex_att = glGetAttribLocation(program, "uv");
-            glVertexAttribPointer(tex_att, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(GLfloat), (void*)(9 * sizeof(GLfloat)));
-            glEnableVertexAttribArray(tex_att);
-        }
-        if (name_.find("tree") == 0) {
-            glm::mat4 scaling = glm::scale(glm::mat4(1.0), scale_);
-            GLint world_mat = glGetUniformLocation(program, "world_mat");
-            glUniformMatrix4fv(world_mat, 1, GL_FALSE, glm::value_ptr(GetTrans() * scaling));
+        if (transforms_) {
+            return transforms_->GetWorldMatrix(slot_);
         }
-        else if (name_.find("boxtop") == 0) {
-            glm::mat4 scaling = glm::scale(glm::mat4(1.0), scale_);
-            GLint world_mat = glGetUniformLocation(program, "world_mat");
-            glUniformMatrix4fv(world_mat, 1, GL_FALSE, glm::value_ptr(GetTrans() * scaling));
+        glm::mat4 local = TransformStore::ComposeLocal(position_, orientation_, pivot_);
+        return parent_ ? parent_->GetWorldMatrix() * local : local;
+    }
+
+
+    glm::mat4 SceneNode::GetWorldTransform(void) const {
+
+        if (transforms_) {
+            return transforms_->GetWorldTransform(slot_);
         }
-        else {
-            glm::mat4 scaling = glm::scale(glm::mat4(1.0), scale_);
-            glm::mat4 rotation = glm::mat4_cast(orientation_);
-            glm::mat4 translation = glm::translate(glm::mat4(1.0), position_);
-            glm::mat4 transf = translation * rotation * scaling;
+        return GetWorldMatrix() * glm::scale(glm::mat4(1.0), scale_);
+    }
 
-            GLint world_mat = glGetUniformLocation(program, "world_mat");
-            glUniformMatrix4fv(world_mat, 1, GL_FALSE, glm::value_ptr(transf));
 
-            // Normal matrix
-            glm::mat4 normal_matrix = glm::transpose(glm::inverse(transf));
-            GLint normal_mat = glGetUniformLocation(program, "normal_mat");
-            glUniformMatrix4fv(normal_mat, 1, GL_FALSE, glm::value_ptr(normal_matrix));
+    glm::mat4 SceneNode::GetNormalMatrix(void) const {
+
+        if (transforms_) {
+            return transforms_->GetNormalMatrix(slot_);
         }
+        return glm::transpose(glm::inverse(GetWorldTransform()));
+    }
 
-        // Texture
+
+    void SceneNode::GetWorldBounds(glm::vec3 &center, float &radius) const {
+
+        glm::mat4 transf = GetWorldTransform();
+        center = glm::vec3(transf[3]);
+
+        // Largest scale of the transformation
+        float scale = glm::max(glm::length(glm::vec3(transf[0])), glm::max(glm::length(glm::vec3(transf[1])), glm::length(glm::vec3(transf[2]))));
+        radius = bound_radius_ * scale;
+    }
+
+
+    void SceneNode::Draw(Camera* camera, Light* light) {
+
+        // Depth and blending state is set up by the scene graph for the
+        // whole render layer
+
+        // Select proper material (shader program)
+        glUseProgram(material_);
+
+        // Set geometry to draw
+        glBindVertexArray(vertex_array_);
+
+        // Set texture
         if (texture_) {
-            GLint tex = glGetUniformLocation(program, "texture_map");
-            glUniform1i(tex, 0); // Assign the first texture to the map
             glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, texture_); // First texture we bind
-            // Define texture interpolation
-            glGenerateMipmap(GL_TEXTURE_2D);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glBindTexture(GL_TEXTURE_2D, texture_);
+        }
+
+        // Camera, light and time come from the frame constants, written
+        // once per frame by the draw queue
+
+        // Set world matrix and other shader input variables
+        SetupShader(material_);
+        // Draw geometry
+        DrawGeometry();
+    }
+
+
+    void SceneNode::DrawGeometry(void) {
+
+        // The geometry is a range of the arena buffers
+        if (mode_ == GL_POINTS) {
+            glDrawArrays(mode_, geometry_->GetBaseVertex(), size_);
+        }
+        else {
+            glDrawElementsBaseVertex(mode_, size_, GL_UNSIGNED_INT, (void *) (geometry_->GetFirstIndex() * sizeof(GLuint)), geometry_->GetBaseVertex());
         }
+    }
+
 
-        // Timer
-        GLint timer_var = glGetUniformLocation(program, "timer");
-        double current_time = glfwGetTime();
-        glUniform1f(timer_var, (float)current_time);
+    void SceneNode::Update(void) {
 
-        GLint position_interp = glGetUniformLocation(program, "position");
-        glUniform3fv(position_interp, 1, glm::value_ptr(GetPosition()));
+        // Do nothing for this generic type of scene node
+    }
+
+
+    void SceneNode::SetupShader(GLuint program, bool instanced) {
+        const ProgramInfo &info = ProgramInfo::Get(program);
+
+        // World and normal matrices, cached in the transform store until
+        // the node or one of its parents moves
+        if (!instanced) {
+            glUniformMatrix4fv(info.GetUniform(WorldMatUniform), 1, GL_FALSE, glm::value_ptr(GetWorldTransform()));
+            glUniformMatrix4fv(info.GetUniform(NormalMatUniform), 1, GL_FALSE, glm::value_ptr(GetNormalMatrix()));
+        }
+
+        // Texture, bound to the first texture unit by the caller;
+        // interpolation is set up when the texture is loaded
+        if (texture_) {
+            glUniform1i(info.GetUniform(TextureMapUniform), 0); // Assign the first texture to the map
+        }
+
+        if (!instanced) {
+            glUniform3fv(info.GetUniform(PositionUniform), 1, glm::value_ptr(GetPosition()));
+        }
     }
 
 } // namespace game;
@@ -11,11 +11,17 @@
 #include <glm/gtc/quaternion.hpp>
 
 #include "resource.h"
+#include "node_handle.h"
+#include "transform_store.h"
 #include "camera.h"
 #include "light.h"
 
 namespace game {
 
+    // Render layers, drawn in this order with their own GL state
+    typedef enum Layer { SkyLayer, OpaqueLayer, BlendedLayer, ParticleLayer } RenderLayer;
+    #define NUM_RENDER_LAYERS 4
+
     // Class that manages one object in a scene 
     class SceneNode {
 
@@ -27,7 +33,10 @@ namespace game {
         ~SceneNode();
 
         // Get name of node
-        const std::string GetName(void) const;
+        const std::string &GetName(void) const;
+        // Handle of the node in its scene graph
+        NodeHandle GetHandle(void) const;
+        void SetHandle(NodeHandle handle);
 
         // Get node attributes
         glm::vec3 GetPosition(void) const;
@@ -37,18 +46,56 @@ namespace game {
         float GetAngle(void) const;
         float GetHight(void) const;
         bool GetBlending(void) const;
+        // Layer the node is drawn in; picked when the node is added to the
+        // scene graph
+        RenderLayer GetLayer(void) const;
         virtual SceneNode* GetPlayer(void) const;
         std::string GetInteraction(void) const;
-
-        void SetTrans(glm::mat4 o);
-        //get final transformation
-        glm::mat4 GetTrans();
+        // Matrix that places the node in the world, as used for drawing
+        // In a scene graph, the matrices are the ones the graph last
+        // composed; the getters never compose them themselves
+        glm::mat4 GetWorldTransform(void) const;
+        // Same matrix without the scale of the node; children are placed
+        // relative to it
+        glm::mat4 GetWorldMatrix(void) const;
+        // Inverse transpose of the world transform, for normals
+        glm::mat4 GetNormalMatrix(void) const;
+        // Bounding sphere of the node in world space; a radius of zero
+        // means the extent of the geometry is not known
+        void GetWorldBounds(glm::vec3 &center, float &radius) const;
+        // Whether the node can be culled: sky and particle nodes, and
+        // nodes without bounds, are always drawn
+        bool GetCullable(void) const;
+        // Static nodes do not move once the scene is set up; their
+        // geometry can be merged by SceneGraph::BakeStatic
+        bool GetStatic(void) const;
+        void SetStatic(bool is_static);
+        // Rotation applied to the orientation at every update of the
+        // scene graph
+        glm::quat GetSpin(void) const;
+        void SetSpin(glm::quat spin);
+
+        // Hierarchy: a node is placed relative to its parent, and moving
+        // the parent moves its whole subtree
+        SceneNode *GetParent(void) const;
+        void SetParent(SceneNode *parent);
+        const std::vector<SceneNode *> &GetChildren(void) const;
+        // Point the node rotates around, in its own space
+        glm::vec3 GetPivot(void) const;
+        void SetPivot(glm::vec3 pivot);
+
+        // Store that holds the transformation of the node, set by the scene
+        // graph the node is added to; NULL while the node is on its own
+        // A parent in another store is ignored
+        void SetTransformStore(TransformStore *transforms, int slot);
+        TransformStore *GetTransformStore(void) const;
 
         // Set node attributes
         void SetPosition(glm::vec3 position);
         void SetOrientation(glm::quat orientation);
         void SetScale(glm::vec3 scale);
         void SetBlending(bool blending);
+        void SetLayer(RenderLayer layer);
         void SetRadius(float radius);
         void SetAngle(float angle);
         void SetTexture(Resource* texture);
@@ -64,38 +111,64 @@ namespace game {
         // Draw the node according to scene parameters in 'camera'
         // variable
         virtual void Draw(Camera* camera, Light*light);
+        // Set matrices that transform the node in a shader program
+        // The program, vertex array and texture must already be bound
+        // For an instanced program only the inputs shared by all
+        // instances are set
+        void SetupShader(GLuint program, bool instanced = false);
+        // Issue the draw call for the bound geometry
+        void DrawGeometry(void);
 
         // Update the node
         virtual void Update(void);
 
         // OpenGL variables
         GLenum GetMode(void) const;
-        GLuint GetArrayBuffer(void) const;
-        GLuint GetElementArrayBuffer(void) const;
+        // Geometry resource, in the shared geometry arena
+        const Resource *GetGeometry(void) const;
         GLsizei GetSize(void) const;
         GLuint GetMaterial(void) const;
+        // Variant of the material for instanced drawing, zero if none
+        GLuint GetInstancedMaterial(void) const;
+        GLuint GetTexture(void) const;
+        // Vertex arrays that feed the geometry to the material and to its
+        // instanced variant
+        GLuint GetVertexArray(void) const;
+        GLuint GetInstancedVertexArray(void) const;
 
     private:
+        // Mirror the parent of the node in its transform store
+        void UpdateParentSlot(void);
+
         std::string name_; // Name of the scene node
-        GLuint array_buffer_; // References to geometry: vertex and array buffers
-        GLuint element_array_buffer_;
+        NodeHandle handle_; // Handle in the scene graph, null until added
+        const Resource *geometry_; // Reference to geometry
         GLenum mode_; // Type of geometry
         GLsizei size_; // Number of primitives in geometry
+        float bound_radius_; // Bounding sphere radius of the geometry
         GLuint material_; // Reference to shader program
+        GLuint instanced_material_; // Instanced variant of the program
+        GLuint vertex_array_; // Vertex array for the program
+        GLuint instanced_vertex_array_; // Vertex array for the instanced variant
         GLuint texture_; // Reference to texture resource
+        TransformStore *transforms_; // Store of the transformation, if any
+        int slot_; // Slot of the node in the store
+        // Transformation while the node is not in a store
         glm::vec3 position_; // Position of node
         glm::quat orientation_; // Orientation of node
         glm::vec3 scale_; // Scale of node
+        glm::quat spin_; // Rotation per update
         float radius_;
         float angle_;
         bool blending_; // Draw with blending or not
-        glm::mat4 finaltrans_;//final tranformation
+        RenderLayer layer_; // Render layer of the node
+        bool static_; // Never moves
+        SceneNode *parent_; // Node this one is placed relative to
+        std::vector<SceneNode *> children_;
+        glm::vec3 pivot_; // Center of rotation
         SceneNode* player_;
         std::string interaction_ = "Nothing";
 
-        // Set matrices that transform the node in a shader program
-        void SetupShader(GLuint program);
-
     }; // class SceneNode
 
 } // namespace game
@@ -0,0 +1,79 @@
+#version 430
+
+// Frustum culling of the nodes drawn by indirect draw calls
+// One invocation per node: a visible node gets a draw command with one
+// instance of its geometry, a culled node a command that draws nothing.
+// The instance is the slot of the node, so the instanced vertex program
+// fetches its world matrix from the node transforms
+
+layout(local_size_x = 64) in;
+
+// Per-node inputs, by slot, as in the instance buffer: world matrix,
+// normal matrix (3x3) and position
+layout(std430, binding = 0) readonly buffer NodeTransforms {
+    float transform[];
+};
+
+// Range of the geometry of each node in the shared buffers, and the radius
+// of its bounding sphere in object space; zero when the extent is unknown
+struct NodeDraw {
+    uint count;
+    uint first_index;
+    int base_vertex;
+    float radius;
+};
+
+layout(std430, binding = 1) readonly buffer NodeDraws {
+    NodeDraw draw[];
+};
+
+// Layout of glMultiDrawElementsIndirect
+struct DrawCommand {
+    uint count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance;
+};
+
+layout(std430, binding = 2) writeonly buffer DrawCommands {
+    DrawCommand command[];
+};
+
+// Planes as (normal, distance), with the normal pointing inside
+uniform vec4 frustum_planes[6];
+uniform uint num_nodes;
+
+#define TRANSFORM_FLOATS 28
+
+
+void main()
+{
+    uint node = gl_GlobalInvocationID.x;
+    if (node >= num_nodes){
+        return;
+    }
+
+    // Bounding sphere in world space, as SceneNode::GetWorldBounds
+    uint t = node * TRANSFORM_FLOATS;
+    vec3 x = vec3(transform[t + 0], transform[t + 1], transform[t + 2]);
+    vec3 y = vec3(transform[t + 4], transform[t + 5], transform[t + 6]);
+    vec3 z = vec3(transform[t + 8], transform[t + 9], transform[t + 10]);
+    vec3 center = vec3(transform[t + 12], transform[t + 13], transform[t + 14]);
+    float radius = draw[node].radius * max(length(x), max(length(y), length(z)));
+
+    bool visible = true;
+    if (draw[node].radius > 0.0){
+        for (int i = 0; i < 6; i++){
+            if (dot(frustum_planes[i].xyz, center) + frustum_planes[i].w < -radius){
+                visible = false;
+            }
+        }
+    }
+
+    command[node].count = draw[node].count;
+    command[node].instance_count = visible ? 1u : 0u;
+    command[node].first_index = draw[node].first_index;
+    command[node].base_vertex = draw[node].base_vertex;
+    command[node].base_instance = node;
+}
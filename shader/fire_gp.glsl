@@ -8,9 +8,6 @@ layout (triangle_strip, max_vertices = 4) out;
 in vec4 particle_color[];
 in float particle_id[];
 
-// Uniform (global) buffer
-uniform mat4 projection_mat;
-
 // Simulation parameters (constants)
 float particle_size = 0.1;
 
@@ -7,9 +7,7 @@ in vec3 color;
 
 // Uniform (global) buffer
 uniform mat4 world_mat;
-uniform mat4 view_mat;
 uniform mat4 normal_mat;
-uniform float timer;
 
 // Attributes forwarded to the geometry shader
 out vec4 particle_color;
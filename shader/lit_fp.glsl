@@ -9,7 +9,6 @@ in vec3 light_pos;
 in vec3 view_pos;
 // Uniform (global) buffer
 uniform sampler2D texture_map;
-uniform vec3 view_position;
 
 
 void main() 
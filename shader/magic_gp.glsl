@@ -8,9 +8,6 @@ layout (triangle_strip, max_vertices = 4) out;
 in vec3 vertex_color[];
 in float timestep[];
 
-// Uniform (global) buffer
-uniform mat4 projection_mat;
-
 // Simulation parameters (constants)
 uniform float particle_size = 0.01;
 
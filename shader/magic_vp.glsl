@@ -9,9 +9,7 @@ in float lifespan;
 
 // Uniform (global) buffer
 uniform mat4 world_mat;
-uniform mat4 view_mat;
 uniform mat4 normal_mat;
-uniform float timer;
 uniform vec3 camera_position;
 
 // Attributes forwarded to the geometry shader
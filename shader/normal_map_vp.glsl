@@ -10,8 +10,6 @@ out vec2 uv_interp;
 
 // Uniform (global) buffer
 uniform mat4 world_mat;
-uniform mat4 view_mat;
-uniform mat4 projection_mat;
 uniform mat4 normal_mat;
 
 
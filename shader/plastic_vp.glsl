@@ -9,8 +9,6 @@ in vec3 color;
 
 // Uniform (global) buffer
 uniform mat4 world_mat;
-uniform mat4 view_mat;
-uniform mat4 projection_mat;
 uniform mat4 normal_mat;
 
 // Attributes forwarded to the fragment shader
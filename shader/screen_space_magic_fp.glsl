@@ -4,7 +4,6 @@
 in vec2 uv0;
 
 // Passed from outside
-uniform float timer;
 uniform sampler2D texture_map;
 
 void main() 
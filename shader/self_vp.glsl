@@ -8,8 +8,6 @@ in vec2 uv;
 
 // Uniform (global) buffer
 uniform mat4 world_mat;
-uniform mat4 view_mat;
-uniform mat4 projection_mat;
 uniform mat4 normal_mat;
 
 // Attributes forwarded to the fragment shader
@@ -19,9 +17,6 @@ out vec4 color_interp;
 out vec2 uv_interp;
 out vec3 light_pos;
 
-// Material attributes (constants)
-uniform vec3 light_position;
-
 
 void main()
 {
@@ -6,12 +6,17 @@ in vec3 normal;
 in vec3 color;
 in vec2 uv;
 
-// Uniform (global) buffer
+// Per-node inputs: instance attributes when drawn instanced, uniforms
+// otherwise
+#ifdef INSTANCED
+in mat4 instance_world_mat;
+in mat3 instance_normal_mat;
+#define world_mat instance_world_mat
+#define normal_mat mat4(instance_normal_mat)
+#else
 uniform mat4 world_mat;
-uniform mat4 view_mat;
-uniform mat4 projection_mat;
 uniform mat4 normal_mat;
-uniform vec3 position;
+#endif
 
 // Attributes forwarded to the fragment shader
 out vec3 position_interp;
@@ -23,9 +28,6 @@ out vec3 light_col;
 out vec3 view_pos;
 
 // Material attributes (constants)
-uniform vec3 light_position;
-uniform vec3 light_color;
-uniform vec3 view_position;
 
 
 void main()
@@ -41,8 +43,10 @@ void main()
     uv_interp = uv;
 
     light_col = light_color;
-    position_interp = vec3(world_mat * vec4(position, 1.0));
-    light_pos = vec3(world_mat * vec4(light_position, 1.0));
-    view_pos = vec3(world_mat * vec4(view_position, 1.0));
+    // Light in world space, so the result does not depend on how the
+    // geometry is split into nodes
+    position_interp = vec3(world_mat * vec4(vertex, 1.0));
+    light_pos = light_position;
+    view_pos = view_position;
     //view_pos = view_position;
 }
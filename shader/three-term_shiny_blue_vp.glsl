@@ -9,8 +9,6 @@ in vec3 color;
 
 // Uniform (global) buffer
 uniform mat4 world_mat;
-uniform mat4 view_mat;
-uniform mat4 projection_mat;
 uniform mat4 normal_mat;
 
 // Attributes forwarded to the fragment shader
@@ -18,13 +16,6 @@ out vec3 position_interp;
 out vec3 normal_interp;
 out vec3 light_pos;
 
-// Material attributes (constants)
-//
-// Could be loaded from a configuration file and also passed with the
-// uniform buffer
-uniform vec3 light_position;
-
-
 
 void main()
 {
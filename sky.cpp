@@ -8,6 +8,9 @@
 namespace game {
 
     Sky::Sky(const std::string name, const Resource* geometry, const Resource* material, const Resource* texture) : SceneNode(name, geometry, material,texture) {
+
+        // Sky faces are drawn first, behind everything else
+        SetLayer(SkyLayer);
     }
 
 
@@ -0,0 +1,465 @@
+#include <algorithm>
+
+#include "transform_store.h"
+
+namespace game {
+
+TransformStore::TransformStore(void){
+
+    order_dirty_ = false;
+    stepping_ = false;
+    written_count_ = 0;
+    interpolating_ = false;
+}
+
+
+TransformStore::~TransformStore(){
+}
+
+
+void TransformStore::Add(int slot){
+
+    if (slot >= active_.size()){
+        int size = slot + 1;
+        position_.resize(size);
+        orientation_.resize(size);
+        scale_.resize(size);
+        pivot_.resize(size);
+        spin_.resize(size);
+        parent_.resize(size, -1);
+        local_.resize(size);
+        world_.resize(size);
+        transform_.resize(size);
+        normal_.resize(size);
+        version_.resize(size, 0);
+        parent_version_.resize(size, 0);
+        active_.resize(size, 0);
+        spinning_.resize(size, 0);
+        local_dirty_.resize(size, 0);
+        scale_dirty_.resize(size, 0);
+        moved_.resize(size, 0);
+        depth_.resize(size, 0);
+        step_state_.resize(size, StepUnchanged);
+        written_.resize(size);
+        previous_position_.resize(size);
+        previous_orientation_.resize(size);
+        saved_.resize(size, 0);
+    }
+
+    position_[slot] = glm::vec3(0.0, 0.0, 0.0);
+    orientation_[slot] = glm::quat();
+    scale_[slot] = glm::vec3(1.0, 1.0, 1.0);
+    pivot_[slot] = glm::vec3(0.0, 0.0, 0.0);
+    spin_[slot] = glm::quat();
+    parent_[slot] = -1;
+    active_[slot] = 1;
+    spinning_[slot] = 0;
+    local_dirty_[slot] = 1;
+    scale_dirty_[slot] = 1;
+    order_dirty_ = true;
+
+    // A slot added by a step has no old placement and shows up where it is
+    if (stepping_){
+        if (step_state_[slot] == StepUnchanged){
+            written_[written_count_++] = slot;
+        }
+        step_state_[slot] = StepAdded;
+    }
+}
+
+
+void TransformStore::Remove(int slot){
+
+    active_[slot] = 0;
+    spinning_[slot] = 0;
+    parent_[slot] = -1;
+    if (moved_[slot]){
+        moved_list_.erase(std::remove(moved_list_.begin(), moved_list_.end(), slot), moved_list_.end());
+        moved_[slot] = 0;
+    }
+    // A new node in the slot must not be blended from this one
+    stepped_.erase(std::remove(stepped_.begin(), stepped_.end(), slot), stepped_.end());
+    order_dirty_ = true;
+}
+
+
+glm::vec3 TransformStore::GetPosition(int slot) const {
+
+    return position_[slot];
+}
+
+
+glm::quat TransformStore::GetOrientation(int slot) const {
+
+    return orientation_[slot];
+}
+
+
+glm::vec3 TransformStore::GetScale(int slot) const {
+
+    return scale_[slot];
+}
+
+
+glm::vec3 TransformStore::GetPivot(int slot) const {
+
+    return pivot_[slot];
+}
+
+
+void TransformStore::SetPosition(int slot, glm::vec3 position){
+
+    KeepPrevious(slot);
+    position_[slot] = position;
+    local_dirty_[slot] = 1;
+}
+
+
+void TransformStore::SetOrientation(int slot, glm::quat orientation){
+
+    KeepPrevious(slot);
+    orientation_[slot] = orientation;
+    local_dirty_[slot] = 1;
+}
+
+
+void TransformStore::SetScale(int slot, glm::vec3 scale){
+
+    scale_[slot] = scale;
+    scale_dirty_[slot] = 1;
+}
+
+
+void TransformStore::SetPivot(int slot, glm::vec3 pivot){
+
+    pivot_[slot] = pivot;
+    local_dirty_[slot] = 1;
+}
+
+
+glm::quat TransformStore::GetSpin(int slot) const {
+
+    return spin_[slot];
+}
+
+
+void TransformStore::SetSpin(int slot, glm::quat spin){
+
+    spin_[slot] = spin;
+    spinning_[slot] = (spin == glm::quat()) ? 0 : 1;
+}
+
+
+int TransformStore::GetParent(int slot) const {
+
+    return parent_[slot];
+}
+
+
+void TransformStore::SetParent(int slot, int parent){
+
+    if (parent_[slot] == parent){
+        return;
+    }
+    parent_[slot] = parent;
+    // Rebuild the world matrix against the new parent
+    local_dirty_[slot] = 1;
+    order_dirty_ = true;
+}
+
+
+void TransformStore::ApplySpins(void){
+
+    ApplySpins(0, spinning_.size());
+}
+
+
+void TransformStore::ApplySpins(int begin, int end){
+
+    for (int i = begin; i < end; i++){
+        if (spinning_[i]){
+            KeepPrevious(i);
+            orientation_[i] = glm::normalize(orientation_[i] * spin_[i]);
+            local_dirty_[i] = 1;
+        }
+    }
+}
+
+
+void TransformStore::BuildOrder(void){
+
+    // Depth of every active slot; hierarchies are shallow, so walking up
+    // from each slot is cheap
+    int size = active_.size();
+    int max_depth = 0;
+    for (int i = 0; i < size; i++){
+        if (!active_[i]){
+            continue;
+        }
+        int depth = 0;
+        for (int p = parent_[i]; p != -1; p = parent_[p]){
+            depth++;
+        }
+        depth_[i] = depth;
+        max_depth = std::max(max_depth, depth);
+    }
+
+    // Counting sort by depth
+    level_start_.assign(max_depth + 2, 0);
+    for (int i = 0; i < size; i++){
+        if (active_[i]){
+            level_start_[depth_[i] + 1]++;
+        }
+    }
+    for (int d = 1; d < level_start_.size(); d++){
+        level_start_[d] += level_start_[d - 1];
+    }
+    std::vector<int> next(level_start_.begin(), level_start_.end() - 1);
+    order_.resize(level_start_.back());
+    for (int i = 0; i < size; i++){
+        if (active_[i]){
+            order_[next[depth_[i]]++] = i;
+        }
+    }
+    order_dirty_ = false;
+}
+
+
+glm::mat4 TransformStore::ComposeLocal(glm::vec3 position, glm::quat orientation, glm::vec3 pivot){
+
+    // Translation * translation(pivot) * rotation * translation(-pivot),
+    // written out
+    glm::mat3 rotation = glm::mat3_cast(orientation);
+    glm::vec3 translation = position + pivot - rotation * pivot;
+    return glm::mat4(glm::vec4(rotation[0], 0.0), glm::vec4(rotation[1], 0.0), glm::vec4(rotation[2], 0.0), glm::vec4(translation, 1.0));
+}
+
+
+void TransformStore::ComposeSlot(int slot){
+
+    int parent = parent_[slot];
+    bool world_dirty = local_dirty_[slot] || (parent != -1 && parent_version_[slot] != version_[parent]);
+
+    // Keep the matrices of the simulation, for EndInterpolation
+    if (interpolating_ && !saved_[slot] && (world_dirty || scale_dirty_[slot])){
+        Composed composed;
+        composed.slot = slot;
+        composed.local = local_[slot];
+        composed.world = world_[slot];
+        composed.transform = transform_[slot];
+        composed.normal = normal_[slot];
+        composed.version = version_[slot];
+        composed.parent_version = parent_version_[slot];
+        composed_.push_back(composed);
+        saved_[slot] = 1;
+    }
+
+    if (local_dirty_[slot]){
+        local_[slot] = ComposeLocal(position_[slot], orientation_[slot], pivot_[slot]);
+        local_dirty_[slot] = 0;
+    }
+
+    if (world_dirty){
+        if (parent != -1){
+            world_[slot] = world_[parent] * local_[slot];
+            parent_version_[slot] = version_[parent];
+        } else {
+            world_[slot] = local_[slot];
+        }
+        version_[slot]++;
+        scale_dirty_[slot] = 1;
+    }
+
+    if (scale_dirty_[slot]){
+        // The world matrix is a rotation and a translation, so scaling its
+        // columns gives the transform, and dividing them by the scale gives
+        // the inverse transpose; the translation does not act on normals
+        const glm::mat4 &world = world_[slot];
+        glm::vec3 scale = scale_[slot];
+        glm::mat4 &transform = transform_[slot];
+        glm::mat4 &normal = normal_[slot];
+        for (int i = 0; i < 3; i++){
+            transform[i] = world[i] * scale[i];
+            normal[i] = world[i] / scale[i];
+        }
+        transform[3] = world[3];
+        normal[3] = glm::vec4(0.0, 0.0, 0.0, 1.0);
+        scale_dirty_[slot] = 0;
+
+        if (!moved_[slot]){
+            moved_[slot] = 1;
+            moved_list_.push_back(slot);
+        }
+    }
+}
+
+
+void TransformStore::Compose(void){
+
+    if (order_dirty_){
+        BuildOrder();
+    }
+    int count = order_.size();
+    for (int i = 0; i < count; i++){
+        ComposeSlot(order_[i]);
+    }
+}
+
+
+void TransformStore::Compose(int slot){
+
+    if (parent_[slot] != -1){
+        Compose(parent_[slot]);
+    }
+    ComposeSlot(slot);
+}
+
+
+const glm::mat4 &TransformStore::GetWorldMatrix(int slot) const {
+
+    return world_[slot];
+}
+
+
+const glm::mat4 &TransformStore::GetWorldTransform(int slot) const {
+
+    return transform_[slot];
+}
+
+
+const glm::mat4 &TransformStore::GetNormalMatrix(int slot) const {
+
+    return normal_[slot];
+}
+
+
+int TransformStore::GetSlotCount(void) const {
+
+    return active_.size();
+}
+
+
+const std::vector<int> &TransformStore::GetOrder(void){
+
+    if (order_dirty_){
+        BuildOrder();
+    }
+    return order_;
+}
+
+
+const std::vector<int> &TransformStore::GetLevelStart(void){
+
+    if (order_dirty_){
+        BuildOrder();
+    }
+    return level_start_;
+}
+
+
+const std::vector<int> &TransformStore::GetMoved(void) const {
+
+    return moved_list_;
+}
+
+
+void TransformStore::ClearMoved(void){
+
+    for (int i = 0; i < moved_list_.size(); i++){
+        moved_[moved_list_[i]] = 0;
+    }
+    moved_list_.clear();
+}
+
+
+void TransformStore::KeepPrevious(int slot){
+
+    if (stepping_ && step_state_[slot] == StepUnchanged){
+        previous_position_[slot] = position_[slot];
+        previous_orientation_[slot] = orientation_[slot];
+        step_state_[slot] = StepWritten;
+        written_[written_count_++] = slot;
+    }
+}
+
+
+void TransformStore::BeginStep(void){
+
+    stepping_ = true;
+}
+
+
+void TransformStore::EndStep(void){
+
+    stepped_.clear();
+    int count = written_count_;
+    for (int i = 0; i < count; i++){
+        int slot = written_[i];
+        if (step_state_[slot] == StepWritten && active_[slot] &&
+            (position_[slot] != previous_position_[slot] || orientation_[slot] != previous_orientation_[slot])){
+            stepped_.push_back(slot);
+        }
+        step_state_[slot] = StepUnchanged;
+    }
+    written_count_ = 0;
+    stepping_ = false;
+}
+
+
+void TransformStore::Interpolate(float alpha){
+
+    // Compose the placement of the simulation first, so that the matrices
+    // kept while interpolating are the ones it would have
+    Compose();
+
+    // The placement may have changed since the step, from outside the
+    // simulation; that is where the slot goes at the end of the blend
+    stepped_position_.resize(stepped_.size());
+    stepped_orientation_.resize(stepped_.size());
+    for (int i = 0; i < stepped_.size(); i++){
+        int slot = stepped_[i];
+        stepped_position_[i] = position_[slot];
+        stepped_orientation_[i] = orientation_[slot];
+        position_[slot] = glm::mix(previous_position_[slot], position_[slot], alpha);
+        orientation_[slot] = glm::slerp(previous_orientation_[slot], orientation_[slot], alpha);
+        local_dirty_[slot] = 1;
+    }
+    interpolating_ = true;
+}
+
+
+void TransformStore::EndInterpolation(void){
+
+    if (!interpolating_){
+        return;
+    }
+    for (int i = 0; i < stepped_.size(); i++){
+        int slot = stepped_[i];
+        position_[slot] = stepped_position_[i];
+        orientation_[slot] = stepped_orientation_[i];
+    }
+
+    // Put back the matrices of the simulation; the slots are reported as
+    // moved, so the bounds follow them back
+    for (int i = 0; i < composed_.size(); i++){
+        const Composed &composed = composed_[i];
+        int slot = composed.slot;
+        local_[slot] = composed.local;
+        world_[slot] = composed.world;
+        transform_[slot] = composed.transform;
+        normal_[slot] = composed.normal;
+        version_[slot] = composed.version;
+        parent_version_[slot] = composed.parent_version;
+        local_dirty_[slot] = 0;
+        scale_dirty_[slot] = 0;
+        saved_[slot] = 0;
+        if (!moved_[slot]){
+            moved_[slot] = 1;
+            moved_list_.push_back(slot);
+        }
+    }
+    composed_.clear();
+    interpolating_ = false;
+}
+
+} // namespace game
@@ -0,0 +1,167 @@
+#ifndef TRANSFORM_STORE_H_
+#define TRANSFORM_STORE_H_
+
+#include <vector>
+#include <atomic>
+#include <glm/glm.hpp>
+#define GLM_FORCE_RADIANS
+#include <glm/gtc/quaternion.hpp>
+
+namespace game {
+
+    // Transformations of the nodes of a scene graph, stored as parallel
+    // arrays indexed by handle index
+    // Per-frame passes (spinning nodes, rebuilding matrices) walk plain
+    // arrays instead of chasing node pointers. Matrices are rebuilt only
+    // for slots whose placement or parent changed; a slot notices a moved
+    // parent by comparing the version of the parent's world matrix with the
+    // one it was built from
+    class TransformStore {
+
+        public:
+            TransformStore(void);
+            ~TransformStore();
+
+            // Start using a slot, at the origin with no parent
+            void Add(int slot);
+            // Stop using a slot
+            void Remove(int slot);
+
+            // Placement of a slot relative to its parent
+            glm::vec3 GetPosition(int slot) const;
+            glm::quat GetOrientation(int slot) const;
+            glm::vec3 GetScale(int slot) const;
+            glm::vec3 GetPivot(int slot) const;
+            void SetPosition(int slot, glm::vec3 position);
+            void SetOrientation(int slot, glm::quat orientation);
+            void SetScale(int slot, glm::vec3 scale);
+            void SetPivot(int slot, glm::vec3 pivot);
+            // Rotation applied to the orientation by every ApplySpins
+            glm::quat GetSpin(int slot) const;
+            void SetSpin(int slot, glm::quat spin);
+            // Parent slot, -1 for none
+            int GetParent(int slot) const;
+            void SetParent(int slot, int parent);
+
+            // Rotate every spinning slot by its spin
+            void ApplySpins(void);
+            // Same for the slots in [begin, end); ranges that do not overlap
+            // can be done in parallel
+            void ApplySpins(int begin, int end);
+            // Rebuild the matrices of the slots that changed, parents first
+            void Compose(void);
+            // Same for one slot and its parents only
+            void Compose(int slot);
+
+            // Matrices of a slot as of the last Compose; reading them
+            // changes nothing, so drawing can be recorded in parallel
+            // World matrix without the scale of the slot
+            const glm::mat4 &GetWorldMatrix(int slot) const;
+            // World matrix with the scale, as used for drawing
+            const glm::mat4 &GetWorldTransform(int slot) const;
+            // Inverse transpose of the world transform
+            const glm::mat4 &GetNormalMatrix(int slot) const;
+
+            // Number of slots, including unused ones
+            int GetSlotCount(void) const;
+            // Active slots sorted by depth in the hierarchy; the slots of
+            // level l are order[level_start[l]] up to order[level_start[l + 1]]
+            const std::vector<int> &GetOrder(void);
+            const std::vector<int> &GetLevelStart(void);
+
+            // Slots whose world transform changed since the last ClearMoved
+            const std::vector<int> &GetMoved(void) const;
+            void ClearMoved(void);
+
+            // Drawing between two simulation steps
+            // Between BeginStep and EndStep, the first write to the
+            // position or orientation of a slot keeps its old value; EndStep
+            // finds the slots the step moved from those
+            void BeginStep(void);
+            void EndStep(void);
+            // Place the slots moved by the last step 'alpha' of the way from
+            // their old placement to their new one, for drawing; until
+            // EndInterpolation puts back the placement of the simulation,
+            // and the matrices composed from it, without composing again
+            void Interpolate(float alpha);
+            void EndInterpolation(void);
+
+            // Matrix that places a node relative to its parent; no scale
+            static glm::mat4 ComposeLocal(glm::vec3 position, glm::quat orientation, glm::vec3 pivot);
+
+        private:
+            // Placement
+            std::vector<glm::vec3> position_;
+            std::vector<glm::quat> orientation_;
+            std::vector<glm::vec3> scale_;
+            std::vector<glm::vec3> pivot_;
+            std::vector<glm::quat> spin_;
+            std::vector<int> parent_;
+
+            // Cached matrices
+            std::vector<glm::mat4> local_;
+            std::vector<glm::mat4> world_;
+            std::vector<glm::mat4> transform_;
+            std::vector<glm::mat4> normal_;
+            // Version of the world matrix, bumped when it is rebuilt
+            std::vector<unsigned int> version_;
+            // Version of the parent's world matrix this slot was built from
+            std::vector<unsigned int> parent_version_;
+
+            // Flags, one byte per slot
+            std::vector<unsigned char> active_;
+            std::vector<unsigned char> spinning_;
+            std::vector<unsigned char> local_dirty_; // Placement changed
+            std::vector<unsigned char> scale_dirty_; // Scale changed
+            std::vector<unsigned char> moved_;
+            std::vector<int> moved_list_;
+
+            // What the current step did to a slot
+            enum StepState { StepUnchanged, StepWritten, StepAdded };
+            bool stepping_;
+            std::vector<unsigned char> step_state_;
+            // Slots the current step wrote or added; nodes are updated in
+            // parallel, so the count is atomic
+            std::vector<int> written_;
+            std::atomic<int> written_count_;
+            // Placements before the step, kept for the slots it wrote
+            std::vector<glm::vec3> previous_position_;
+            std::vector<glm::quat> previous_orientation_;
+            // Slots the last step moved, and their placements after it while
+            // they are interpolated
+            std::vector<int> stepped_;
+            std::vector<glm::vec3> stepped_position_;
+            std::vector<glm::quat> stepped_orientation_;
+            bool interpolating_;
+            // Matrices of the slots composed while interpolating, as they
+            // were before
+            struct Composed {
+                int slot;
+                glm::mat4 local;
+                glm::mat4 world;
+                glm::mat4 transform;
+                glm::mat4 normal;
+                unsigned int version;
+                unsigned int parent_version;
+            };
+            std::vector<Composed> composed_;
+            std::vector<unsigned char> saved_; // Slot is in composed_
+
+            // Active slots sorted by depth in the hierarchy, so that parents
+            // come before their children
+            std::vector<int> order_;
+            std::vector<int> level_start_;
+            std::vector<int> depth_;
+            bool order_dirty_;
+
+            void BuildOrder(void);
+            // Keep the placement of a slot the first time a step writes it
+            void KeepPrevious(int slot);
+            // Rebuild the matrices of one slot; the parent must be up to date
+            void ComposeSlot(int slot);
+
+    }; // class TransformStore
+
+} // namespace game
+
+#endif // TRANSFORM_STORE_H_
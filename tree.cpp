@@ -18,6 +18,8 @@ namespace game {
 
     void Tree::SetMove(glm::vec3 move) {
         tran_ = move;
+        // The branch rotates around its base
+        SetPivot(-move);
     }
     glm::vec3 Tree::GetMove(void) const {
 
@@ -31,6 +33,7 @@ namespace game {
 
     void Tree::SetFather(Tree* root) {
         father_ = root;
+        SetParent(root);
     }
 
     void Tree::SetWind(glm::vec3 wind) {
@@ -75,45 +78,11 @@ namespace game {
             move = -1;
         }
         time += 1;
-        if (GetFather() == NULL) {//root of tree
-
-            glm::mat4 scaling = glm::scale(glm::mat4(1.0), GetScale());
-            glm::mat4 rotation = glm::mat4_cast(GetOrientation());
-            glm::mat4 translation = glm::translate(glm::mat4(1.0), GetPosition());
-            glm::mat4 final = translation * rotation * scaling;
-
-            SetTrans(final);
-
-        }
-        else {//braches of tree
-
-            Rotate(glm::angleAxis((glm::pi<float>() / 3600) * move, wind_));//rotate the tree by vator wind
-            glm::mat4 T = glm::translate(glm::mat4(1.0), tran_);
-            glm::mat4 T2 = glm::translate(glm::mat4(1.0), GetPosition());
-            glm::mat4 R = glm::mat4_cast(GetOrientation());
-            glm::mat4 orbit = T2 * glm::inverse(T) * R * T;//orbit trans
-            SetTrans(GetFather()->GetTrans() * orbit);
+        if (GetFather() != NULL) {//braches of tree
+            // The sway is applied by the scene graph with the other spinning
+            // nodes; the world matrix follows the father through the hierarchy
+            SetSpin(glm::angleAxis((glm::pi<float>() / 3600) * move, wind_));//rotate the tree by vator wind
         }
-
-
-        if (GetName().find("root") == 0) {
-            if (GetPlayer()->GetInteraction() == GetName()) {
-                float distance = glm::distance(glm::vec2(GetPlayer()->GetPosition().x, GetPlayer()->GetPosition().z), glm::vec2(GetPosition().x, GetPosition().z));
-                if (distance < 10) {
-                    GetPlayer()->SetInteraction(GetName());
-                }
-                else {
-                    GetPlayer()->SetInteraction("Nothing");
-                }
-            }
-            else if (GetPlayer()->GetInteraction() == "Nothing") {
-                float distance = glm::distance(glm::vec2(GetPlayer()->GetPosition().x, GetPlayer()->GetPosition().z), glm::vec2(GetPosition().x, GetPosition().z));
-                if (distance < 10) {
-                    GetPlayer()->SetInteraction(GetName());
-                }
-            }
-        }
-
     }
 
 } // namespace game
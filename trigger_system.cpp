@@ -0,0 +1,166 @@
+#include <cmath>
+#include <algorithm>
+
+#include "trigger_system.h"
+
+namespace game {
+
+TriggerSystem::TriggerSystem(float cell_size){
+
+    cell_size_ = cell_size;
+    test_count_ = 0;
+}
+
+
+TriggerSystem::~TriggerSystem(){
+}
+
+
+int TriggerSystem::GetCell(float coordinate) const {
+
+    return (int) floor(coordinate / cell_size_);
+}
+
+
+long long TriggerSystem::GetCellKey(int x, int z){
+
+    // Shift the bits of x, not its value; negative cells would be undefined
+    return (long long) (((unsigned long long) (unsigned int) x << 32) | (unsigned int) z);
+}
+
+
+void TriggerSystem::Hash(int trigger){
+
+    const Trigger &t = trigger_[trigger];
+    for (int x = GetCell(t.center.x - t.radius); x <= GetCell(t.center.x + t.radius); x++){
+        for (int z = GetCell(t.center.y - t.radius); z <= GetCell(t.center.y + t.radius); z++){
+            cell_[GetCellKey(x, z)].push_back(trigger);
+        }
+    }
+}
+
+
+void TriggerSystem::Unhash(int trigger){
+
+    const Trigger &t = trigger_[trigger];
+    for (int x = GetCell(t.center.x - t.radius); x <= GetCell(t.center.x + t.radius); x++){
+        for (int z = GetCell(t.center.y - t.radius); z <= GetCell(t.center.y + t.radius); z++){
+            std::unordered_map<long long, std::vector<int> >::iterator it = cell_.find(GetCellKey(x, z));
+            if (it == cell_.end()){
+                continue;
+            }
+            std::vector<int> &list = it->second;
+            list.erase(std::remove(list.begin(), list.end(), trigger), list.end());
+            if (list.size() == 0){
+                cell_.erase(it);
+            }
+        }
+    }
+}
+
+
+int TriggerSystem::AddTrigger(const std::string &name, glm::vec3 position, float radius){
+
+    int trigger;
+    if (free_.size() > 0){
+        trigger = free_.back();
+        free_.pop_back();
+    } else {
+        trigger_.push_back(Trigger());
+        trigger = trigger_.size() - 1;
+    }
+
+    Trigger &t = trigger_[trigger];
+    t.name = name;
+    t.center = glm::vec2(position.x, position.z);
+    t.radius = radius;
+    t.active = true;
+    Hash(trigger);
+
+    return trigger;
+}
+
+
+void TriggerSystem::RemoveTrigger(int trigger){
+
+    if (trigger < 0 || trigger >= trigger_.size() || !trigger_[trigger].active){
+        return;
+    }
+    Unhash(trigger);
+    trigger_[trigger].active = false;
+    free_.push_back(trigger);
+    inside_.erase(std::remove(inside_.begin(), inside_.end(), trigger), inside_.end());
+}
+
+
+void TriggerSystem::SetTriggerPosition(int trigger, glm::vec3 position){
+
+    Unhash(trigger);
+    trigger_[trigger].center = glm::vec2(position.x, position.z);
+    Hash(trigger);
+}
+
+
+const std::string &TriggerSystem::GetTriggerName(int trigger) const {
+
+    return trigger_[trigger].name;
+}
+
+
+const std::vector<TriggerEvent> &TriggerSystem::Update(glm::vec3 position){
+
+    event_.clear();
+    next_inside_.clear();
+    test_count_ = 0;
+
+    // Every trigger is hashed into all the cells it overlaps, so the cell
+    // of the position holds all the candidates
+    glm::vec2 p(position.x, position.z);
+    std::unordered_map<long long, std::vector<int> >::const_iterator it = cell_.find(GetCellKey(GetCell(p.x), GetCell(p.y)));
+    if (it != cell_.end()){
+        const std::vector<int> &list = it->second;
+        for (int i = 0; i < list.size(); i++){
+            const Trigger &t = trigger_[list[i]];
+            glm::vec2 d = p - t.center;
+            if (glm::dot(d, d) < t.radius * t.radius){
+                next_inside_.push_back(list[i]);
+            }
+            test_count_++;
+        }
+    }
+
+    // Compare with the last update; both lists are short
+    for (int i = 0; i < inside_.size(); i++){
+        if (std::find(next_inside_.begin(), next_inside_.end(), inside_[i]) == next_inside_.end()){
+            TriggerEvent e;
+            e.trigger = inside_[i];
+            e.enter = false;
+            event_.push_back(e);
+        }
+    }
+    for (int i = 0; i < next_inside_.size(); i++){
+        if (std::find(inside_.begin(), inside_.end(), next_inside_[i]) == inside_.end()){
+            TriggerEvent e;
+            e.trigger = next_inside_[i];
+            e.enter = true;
+            event_.push_back(e);
+        }
+    }
+    inside_.swap(next_inside_);
+
+    return event_;
+}
+
+
+const std::vector<int> &TriggerSystem::GetInside(void) const {
+
+    return inside_;
+}
+
+
+int TriggerSystem::GetTestCount(void) const {
+
+    return test_count_;
+}
+
+} // namespace game
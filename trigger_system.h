@@ -0,0 +1,76 @@
+#ifndef TRIGGER_SYSTEM_H_
+#define TRIGGER_SYSTEM_H_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <glm/glm.hpp>
+
+// Size of the cells of the trigger grid, in world units
+#define TRIGGER_CELL_SIZE 16.0f
+
+namespace game {
+
+    // Change of a trigger volume around the tested position
+    struct TriggerEvent {
+        int trigger; // Id of the trigger
+        bool enter; // Entered if true, exited otherwise
+    };
+
+    // Interaction volumes, tested against one position per update
+    // A trigger is a vertical cylinder: only the xz distance to its center
+    // counts. Triggers are hashed into a uniform grid of the xz plane, so an
+    // update only looks at the triggers of the cell the position is in
+    class TriggerSystem {
+
+        public:
+            TriggerSystem(float cell_size = TRIGGER_CELL_SIZE);
+            ~TriggerSystem();
+
+            // Add a trigger and return its id
+            int AddTrigger(const std::string &name, glm::vec3 position, float radius);
+            // Remove a trigger; no exit event is sent for it
+            void RemoveTrigger(int trigger);
+            void SetTriggerPosition(int trigger, glm::vec3 position);
+            const std::string &GetTriggerName(int trigger) const;
+
+            // Test a position against the triggers near it and return the
+            // triggers entered and exited since the last update
+            const std::vector<TriggerEvent> &Update(glm::vec3 position);
+            // Triggers that held the position at the last update
+            const std::vector<int> &GetInside(void) const;
+
+            // Number of distance tests done by the last update
+            int GetTestCount(void) const;
+
+        private:
+            struct Trigger {
+                std::string name;
+                glm::vec2 center;
+                float radius;
+                bool active;
+            };
+
+            float cell_size_;
+            std::vector<Trigger> trigger_;
+            // Ids of removed triggers that can be reused
+            std::vector<int> free_;
+            // Triggers overlapping each grid cell
+            std::unordered_map<long long, std::vector<int> > cell_;
+
+            std::vector<int> inside_;
+            std::vector<int> next_inside_;
+            std::vector<TriggerEvent> event_;
+            int test_count_;
+
+            int GetCell(float coordinate) const;
+            static long long GetCellKey(int x, int z);
+            // Add or remove a trigger from the cells it overlaps
+            void Hash(int trigger);
+            void Unhash(int trigger);
+
+    }; // class TriggerSystem
+
+} // namespace game
+
+#endif // TRIGGER_SYSTEM_H_